@@ -1,5 +1,31 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
@@ -23,15 +49,632 @@ public:
   const static uint8_t Black = 128;
 };
 
+// Returns the value following a flag such as "--threads", or fallback if absent
+string getOption(int argc, char *argv[], const string &flag, const string &fallback)
+{
+  for (int i = 1; i + 1 < argc; i++)
+  {
+    if (argv[i] == flag)
+      return argv[i + 1];
+  }
+  return fallback;
+}
+
+// Selective search switches and parameters, depths are in plies and margins in evaluation units
+// Null-move pruning is left out on purpose: antichess is full of zugzwang
+struct SearchOptions
+{
+  // Late move reductions: quiet moves after the first few are searched shallower
+  // with a null window, and re-searched at full depth if they fail high
+  bool lmr = true;
+  int lmrMinDepth = 3;
+  int lmrMinMoves = 3;
+  int lmrReduction = 1;
+  // Futility pruning: at depth 1, quiet nodes whose evaluation plus the margin
+  // cannot reach the window are cut
+  bool futility = true;
+  int futilityMargin = 9;
+  // Razoring: at depth 2, quiet nodes far below the window lose a ply
+  bool razoring = true;
+  int razorMargin = 5;
+  // Exchange pruning: within the last few plies, quiet moves (other than the first)
+  // whose forced recapture sequence loses more than the margin are skipped
+  bool exchangePruning = true;
+  int exchangeDepth = 2;
+  int exchangeMargin = 2;
+
+  // Reads --lmr, --lmr-depth, --lmr-moves, --lmr-reduction, --futility, --futility-margin,
+  // --razoring, --razor-margin, --exchange-pruning, --exchange-depth and --exchange-margin,
+  // a flag with the suffix appended takes precedence
+  void parse(int argc, char *argv[], const string &suffix = "")
+  {
+    auto read = [&](const string &flag, int current)
+    {
+      return stoi(getOption(argc, argv, flag + suffix, getOption(argc, argv, flag, to_string(current))));
+    };
+    lmr = read("--lmr", lmr);
+    lmrMinDepth = read("--lmr-depth", lmrMinDepth);
+    lmrMinMoves = read("--lmr-moves", lmrMinMoves);
+    lmrReduction = read("--lmr-reduction", lmrReduction);
+    futility = read("--futility", futility);
+    futilityMargin = read("--futility-margin", futilityMargin);
+    razoring = read("--razoring", razoring);
+    razorMargin = read("--razor-margin", razorMargin);
+    exchangePruning = read("--exchange-pruning", exchangePruning);
+    exchangeDepth = read("--exchange-depth", exchangeDepth);
+    exchangeMargin = read("--exchange-margin", exchangeMargin);
+  }
+};
+
+// Set from the command line in main, copied into every SearchContext
+SearchOptions searchOptions;
+
+// Used when searching without a context, every move is searched to full depth
+const SearchOptions exhaustiveOptions = {false, 0, 0, 0, false, 0, false, 0, false, 0, 0};
+
+// Scores beyond DecisiveScore are won or lost games, counting down by one per ply
+// from WinScore (or tablebase scores from 50000) so shorter wins score higher
+const int WinScore = 60000;
+const int DecisiveScore = 40000;
+
+// Rule variants, selected at compile time through GameRules so the generator
+// carries no branches or check detection the variant does not use
+// Antichess: captures are compulsory, the king is an ordinary piece that can be
+// captured or promoted to, there is no check or castling, and a side with no
+// legal moves (including having no pieces) wins
+struct Antichess
+{
+  const static bool forcedCaptures = true;
+  const static bool checks = false;
+  const static bool castling = false;
+  constexpr static const char *promotions = "qrbnk";
+  // Default evaluation weight of the king, an ordinary piece here, valued like a minor piece
+  const static int kingValue = 3;
+
+  // Score for the side to move when it has no legal moves
+  static int noMovesScore(bool /*checked*/)
+  {
+    return WinScore;
+  }
+};
+
+// Standard chess: moves may not leave the king in check, and a side with no legal
+// moves is checkmated or stalemated
+struct StandardChess
+{
+  const static bool forcedCaptures = false;
+  const static bool checks = true;
+  const static bool castling = true;
+  constexpr static const char *promotions = "qrbn";
+  // The king can never be exchanged, so it outweighs all other material
+  const static int kingValue = 1000;
+
+  static int noMovesScore(bool checked)
+  {
+    return checked ? -WinScore : 0;
+  }
+};
+
+#ifdef STANDARD_CHESS
+using GameRules = StandardChess;
+#else
+using GameRules = Antichess;
+#endif
+
+// Piece values used by evaluate()
+struct EvalWeights
+{
+  int pawn = 1;
+  int bishop = 3;
+  int knight = 3;
+  int rook = 5;
+  int queen = 9;
+  int king = GameRules::kingValue;
+
+  // Weight of a piece type (a Piece bit without colour)
+  int value(uint8_t type) const
+  {
+    switch (type)
+    {
+    case Piece::Pawn:
+      return pawn;
+    case Piece::Bishop:
+      return bishop;
+    case Piece::Knight:
+      return knight;
+    case Piece::Rook:
+      return rook;
+    case Piece::Queen:
+      return queen;
+    case Piece::King:
+      return king;
+    }
+    return 0;
+  }
+
+  // Reads "name value" lines such as "pawn 1", unknown names are ignored
+  bool load(const string &path)
+  {
+    ifstream file(path);
+    if (!file)
+      return false;
+    string name;
+    int value;
+    while (file >> name >> value)
+    {
+      if (name == "pawn")
+        pawn = value;
+      else if (name == "bishop")
+        bishop = value;
+      else if (name == "knight")
+        knight = value;
+      else if (name == "rook")
+        rook = value;
+      else if (name == "queen")
+        queen = value;
+      else if (name == "king")
+        king = value;
+    }
+    return true;
+  }
+};
+
+const EvalWeights materialWeights;
+// Weights used by the engine outside self-play, from --weights or the built-in values
+EvalWeights engineWeights;
+
+// Random keys for Zobrist hashing, shared read-only by every thread
+struct Zobrist
+{
+  uint64_t pieces[12][64];
+  uint64_t castling[16];
+  uint64_t enPassant[64];
+  uint64_t blackToMove;
+
+  Zobrist()
+  {
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < 12; i++)
+      for (int j = 0; j < 64; j++)
+        pieces[i][j] = next(seed);
+    for (int i = 0; i < 16; i++)
+      castling[i] = next(seed);
+    for (int i = 0; i < 64; i++)
+      enPassant[i] = next(seed);
+    blackToMove = next(seed);
+  }
+
+  // splitmix64
+  static uint64_t next(uint64_t &seed)
+  {
+    uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  // Maps a piece code to 0..11
+  static int index(uint8_t x)
+  {
+    return __builtin_ctz(x & 63) * 2 + (x & Piece::Black ? 1 : 0);
+  }
+};
+
+const Zobrist zobrist;
+
+// Squares reached from each square by a knight jump and along each line, shared read-only by
+// every thread so the exchange evaluator needs no bounds checks; lines 0-3 are diagonals
+struct AttackTables
+{
+  int8_t knights[64][9];
+  int8_t lines[64][8][8];
+
+  AttackTables()
+  {
+    const int jumps[8][2] = {{1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+    const int directions[8][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}, {1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+    for (int i = 0; i < 64; i++)
+    {
+      int file = i % 8, rank = i / 8, n = 0;
+      for (auto &jump : jumps)
+      {
+        int f = file + jump[0], r = rank + jump[1];
+        if (f >= 0 && f < 8 && r >= 0 && r < 8)
+          knights[i][n++] = r * 8 + f;
+      }
+      knights[i][n] = -1;
+      for (int d = 0; d < 8; d++)
+      {
+        int f = file + directions[d][0], r = rank + directions[d][1];
+        n = 0;
+        while (f >= 0 && f < 8 && r >= 0 && r < 8)
+        {
+          lines[i][d][n++] = r * 8 + f;
+          f += directions[d][0];
+          r += directions[d][1];
+        }
+        lines[i][d][n] = -1;
+      }
+    }
+  }
+};
+
+const AttackTables attackTables;
+
+// Packs a coordinate move as from | to << 6 | promotion << 12, squares indexed as in Board
+uint32_t encodeMove(const string &move)
+{
+  int from = (move[0] - 'a') + 56 - (move[1] - '1') * 8;
+  int to = (move[2] - 'a') + 56 - (move[3] - '1') * 8;
+  uint32_t promotion = 0;
+  if (move.length() == 5)
+    promotion = string("pbnrqk").find(move[4]);
+  return from | to << 6 | promotion << 12;
+}
+
+// Search hash table shared by every search thread, four entries to a 64-byte bucket
+// Entries are stored as key ^ data next to data without locks, so a torn write
+// from two threads only makes the entry fail to verify
+// The table can be saved to a file and mapped back in copy-on-write, so a large
+// table is paged in as the search touches it instead of being read up front
+class TranspositionTable
+{
+public:
+  enum Bound
+  {
+    None,
+    Exact,
+    Lower,
+    Upper
+  };
+
+  // Version 2: decisive scores count down one per ply
+  // Version 3: antichess kings are valued as ordinary pieces
+  const static uint32_t Version = 3;
+
+  TranspositionTable() = default;
+  TranspositionTable(const TranspositionTable &) = delete;
+  TranspositionTable &operator=(const TranspositionTable &) = delete;
+
+  ~TranspositionTable()
+  {
+    release();
+  }
+
+  // NUMA placement for tables allocated or loaded afterwards: "" leaves it to the kernel,
+  // "interleave" spreads pages over every node and a node number binds them to that node
+  string numa;
+
+  // Allocates an empty table of at most mb megabytes, rounded down to a power of two buckets
+  // The table is aligned to 2 MB and advised onto transparent huge pages, since random probes
+  // into a large table otherwise miss the TLB on almost every access
+  bool resize(size_t mb)
+  {
+    uint64_t buckets = 1;
+    while (buckets * 2 * sizeof(Bucket) <= (uint64_t)mb << 20)
+      buckets *= 2;
+    size_t size = sizeof(Header) + buckets * sizeof(Bucket);
+    // Over-allocate by a huge page and trim, so the table starts on a huge page boundary
+    size_t mapped = (size + HugePage - 1) / HugePage * HugePage;
+    uint8_t *raw = (uint8_t *)mmap(nullptr, mapped + HugePage, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+      return false;
+    uint8_t *data = (uint8_t *)(((uintptr_t)raw + HugePage - 1) / HugePage * HugePage);
+    if (data > raw)
+      munmap(raw, data - raw);
+    munmap(data + mapped, raw + HugePage - data);
+    release();
+    adopt(data, size, mapped, buckets);
+    return true;
+  }
+
+  // Maps a saved table, rejecting files from another version or another set of Zobrist keys
+  bool load(const string &path)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(Header))
+    {
+      close(fd);
+      return false;
+    }
+    void *data = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+      return false;
+    const Header *header = (const Header *)data;
+    uint64_t buckets = header->buckets;
+    if (string(header->magic, 4) != "ACTT" || header->version != Version || header->fingerprint != fingerprint() ||
+        buckets == 0 || (buckets & (buckets - 1)) != 0 || sizeof(Header) + buckets * sizeof(Bucket) != (uint64_t)info.st_size)
+    {
+      munmap(data, info.st_size);
+      return false;
+    }
+    release();
+    adopt(data, info.st_size, info.st_size, buckets);
+    return true;
+  }
+
+  // Writes the table to path, through a temporary file so a crash never leaves a torn table behind
+  bool save(const string &path)
+  {
+    if (!mapping)
+      return false;
+    Header *header = (Header *)mapping;
+    memcpy(header->magic, "ACTT", 4);
+    header->version = Version;
+    header->buckets = mask + 1;
+    header->fingerprint = fingerprint();
+    string temporary = path + ".tmp";
+    ofstream file(temporary, ios::binary);
+    file.write((const char *)mapping, length);
+    file.close();
+    if (!file)
+      return false;
+    return rename(temporary.c_str(), path.c_str()) == 0;
+  }
+
+  size_t sizeMB() const
+  {
+    return length >> 20;
+  }
+
+  // Starts loading key's bucket into cache, called ahead of the probe so the miss overlaps other work
+  void prefetch(uint64_t key) const
+  {
+    if (buckets)
+      __builtin_prefetch(&buckets[key & mask]);
+  }
+
+  bool probe(uint64_t key, int &score, int &depth, Bound &bound, uint32_t &move) const
+  {
+    if (!buckets)
+      return false;
+    const Bucket &bucket = buckets[key & mask];
+    for (int i = 0; i < 4; i++)
+    {
+      uint64_t data = bucket.entries[i].data.load(memory_order_relaxed);
+      if ((bucket.entries[i].check.load(memory_order_relaxed) ^ data) != key || data == 0)
+        continue;
+      score = (int32_t)(data >> 32);
+      depth = data >> 24 & 255;
+      bound = (Bound)(data >> 16 & 255);
+      move = data & 0xFFFF;
+      return true;
+    }
+    return false;
+  }
+
+  // Replaces the entry for key if present, otherwise the shallowest entry in the bucket
+  void store(uint64_t key, int score, int depth, Bound bound, uint32_t move)
+  {
+    if (!buckets)
+      return;
+    Bucket &bucket = buckets[key & mask];
+    int replace = 0;
+    int shallowest = 256;
+    for (int i = 0; i < 4; i++)
+    {
+      uint64_t data = bucket.entries[i].data.load(memory_order_relaxed);
+      if ((bucket.entries[i].check.load(memory_order_relaxed) ^ data) == key)
+      {
+        replace = i;
+        break;
+      }
+      int entryDepth = data == 0 ? -1 : data >> 24 & 255;
+      if (entryDepth < shallowest)
+      {
+        shallowest = entryDepth;
+        replace = i;
+      }
+    }
+    uint64_t data = (uint64_t)(uint32_t)score << 32 | (uint64_t)min(depth, 255) << 24 | (uint64_t)bound << 16 | (move & 0xFFFF);
+    bucket.entries[replace].check.store(key ^ data, memory_order_relaxed);
+    bucket.entries[replace].data.store(data, memory_order_relaxed);
+  }
+
+private:
+  struct Header
+  {
+    char magic[4];
+    uint32_t version;
+    uint64_t buckets;
+    uint64_t fingerprint;
+    // Keeps the buckets cache-line aligned behind the header
+    uint8_t reserved[40];
+  };
+
+  struct Entry
+  {
+    atomic<uint64_t> check;
+    atomic<uint64_t> data;
+  };
+
+  struct Bucket
+  {
+    Entry entries[4];
+  };
+
+  const static size_t HugePage = 2 << 20;
+  const static int MpolBind = 2;
+  const static int MpolInterleave = 3;
+
+  uint8_t *mapping = nullptr;
+  size_t length = 0;
+  size_t mapped = 0;
+  Bucket *buckets = nullptr;
+  uint64_t mask = 0;
+
+  // Identifies the Zobrist keys, as keys from different tables must never be mixed
+  static uint64_t fingerprint()
+  {
+    return zobrist.pieces[0][0] ^ zobrist.castling[15] ^ zobrist.blackToMove;
+  }
+
+  // Takes ownership of a mapping, placing it before any page is touched
+  // Both are hints: without huge pages or NUMA support the table just uses normal pages
+  void adopt(void *data, size_t size, size_t mappedSize, uint64_t count)
+  {
+    madvise(data, mappedSize, MADV_HUGEPAGE);
+    if (numa != "" && !bindNuma(data, mappedSize))
+      cerr << "Cannot apply NUMA policy " << numa << ", using the default placement" << endl;
+    mapping = (uint8_t *)data;
+    length = size;
+    mapped = mappedSize;
+    buckets = (Bucket *)(mapping + sizeof(Header));
+    mask = count - 1;
+  }
+
+  // Calls mbind directly so the engine does not need libnuma to build
+  bool bindNuma(void *data, size_t size)
+  {
+    unsigned long nodes = 0;
+    int mode;
+    if (numa == "interleave")
+    {
+      mode = MpolInterleave;
+      // The online nodes are listed as ranges such as "0-1,3"
+      ifstream file("/sys/devices/system/node/online");
+      string range;
+      while (getline(file, range, ','))
+      {
+        int first = 0, last = 0;
+        if (sscanf(range.c_str(), "%d-%d", &first, &last) < 2)
+          last = first;
+        for (int node = first; node <= last && node < 64; node++)
+          nodes |= 1UL << node;
+      }
+    }
+    else
+    {
+      mode = MpolBind;
+      int node = atoi(numa.c_str());
+      if (node < 0 || node >= 64)
+        return false;
+      nodes = 1UL << node;
+    }
+    return nodes != 0 && syscall(SYS_mbind, data, size, mode, &nodes, 64, 0) == 0;
+  }
+
+  void release()
+  {
+    if (mapping)
+      munmap(mapping, mapped);
+    mapping = nullptr;
+    buckets = nullptr;
+    length = 0;
+    mapped = 0;
+    mask = 0;
+  }
+};
+
+// Sized from --hash at startup, and filled from --load-hash when given
+TranspositionTable transpositions;
+
+// Per-thread search state, each worker owns one so searches never share mutable data
+struct SearchContext
+{
+  uint64_t nodes = 0;
+  const EvalWeights *weights = &engineWeights;
+  SearchOptions options = searchOptions;
+  // Shared between the threads of one engine, engines with different evaluations need their own
+  TranspositionTable *table = &transpositions;
+  bool timed = false;
+  bool stopped = false;
+  chrono::steady_clock::time_point deadline;
+  // Principal variation collected at each ply, pv[ply] is the line from that ply on
+  const static int MaxPly = 128;
+  int ply = 0;
+  vector<string> pv[MaxPly];
+  // Position keys of the game since its last irreversible move, then of the search path:
+  // keys[root + ply] is the position at ply, with keys[root] the position searched from
+  vector<uint64_t> keys;
+  int root = 0;
+
+  // Starts a fresh search, a movetime of 0 means no time limit
+  // The time counts from start, so time already spent elsewhere on the move can be included
+  // The game history is cleared, setHistory afterwards supplies it
+  void reset(int movetime, chrono::steady_clock::time_point start = chrono::steady_clock::now())
+  {
+    nodes = 0;
+    stopped = false;
+    keys.clear();
+    root = 0;
+    timed = movetime > 0;
+    if (timed)
+      deadline = start + chrono::milliseconds(movetime);
+  }
+
+  // history holds the game's position keys, ending with the position about to be searched
+  void setHistory(const vector<uint64_t> &history)
+  {
+    keys = history;
+    root = max((int)keys.size() - 1, 0);
+  }
+
+  // Called by the root of a search with its position's key
+  void enterRoot(uint64_t key)
+  {
+    root = max(min(root, (int)keys.size() - 1), 0);
+    keys.resize(root + MaxPly);
+    keys[root] = key;
+  }
+
+  // True if key, the position at the current ply, repeats an earlier one
+  // Only the last halfmove plies can hold a repetition, and only every other one has the
+  // same side to move; a repeat within the search is a draw at once, since the side that
+  // could claim it will, while one from before the root must already have occurred twice
+  bool isRepetition(uint64_t key, int halfmove) const
+  {
+    int index = root + ply;
+    int earlier = 0;
+    for (int back = 4; back <= halfmove && index - back >= 0; back += 2)
+    {
+      if (keys[index - back] != key)
+        continue;
+      if (index - back >= root || ++earlier == 2)
+        return true;
+    }
+    return false;
+  }
+
+  // Only looks at the clock every 1024 nodes
+  bool shouldStop()
+  {
+    if (!stopped && timed && (nodes & 1023) == 0 && chrono::steady_clock::now() >= deadline)
+      stopped = true;
+    return stopped;
+  }
+};
+
+struct SearchResult
+{
+  string move;
+  int score = 0;
+  int depth = 0;
+  uint64_t nodes = 0;
+  vector<string> pv;
+};
+
+class Board;
+
+// Defined after Board, returns true with a white-relative score when a tablebase covers the position
+bool probeTablebaseScore(Board &board, int &score);
+
 class Board
 {
 public:
   Piece square[64];
   int enPassantable = -1;
-  bool castleableBQ = true;
-  bool castleableBK = true;
-  bool castleableWQ = true;
-  bool castleableWK = true;
+  // Plies since the last capture or pawn move, for the 50-move rule
+  int halfmove = 0;
+  bool castleableBQ = GameRules::castling;
+  bool castleableBK = GameRules::castling;
+  bool castleableWQ = GameRules::castling;
+  bool castleableWK = GameRules::castling;
+  uint8_t turn = Piece::White;
   // Initialize the board
   Board()
   {
@@ -60,14 +703,92 @@ public:
     square[63] = Piece(Piece::Rook | Piece::White);
   }
 
+  // Loads a position from a FEN or EPD line, the halfmove clock is taken from a fifth field if it is a number
+  // Returns false and leaves the board untouched if the line is malformed
+  bool loadFen(const string &fen)
+  {
+    istringstream fields(fen);
+    string placement, side, castling, enPassant;
+    if (!(fields >> placement >> side >> castling >> enPassant))
+      return false;
+    Board parsed;
+    int i = 0;
+    for (char c : placement)
+    {
+      if (c == '/')
+        continue;
+      if (c >= '1' && c <= '8')
+      {
+        for (int j = 0; j < c - '0' && i < 64; j++)
+          parsed.square[i++] = Piece(Piece::None);
+        continue;
+      }
+      if (i >= 64)
+        return false;
+      uint8_t colour = isupper(c) ? Piece::White : Piece::Black;
+      uint8_t piece;
+      switch (tolower(c))
+      {
+      case 'p':
+        piece = Piece::Pawn;
+        break;
+      case 'n':
+        piece = Piece::Knight;
+        break;
+      case 'b':
+        piece = Piece::Bishop;
+        break;
+      case 'r':
+        piece = Piece::Rook;
+        break;
+      case 'q':
+        piece = Piece::Queen;
+        break;
+      case 'k':
+        piece = Piece::King;
+        break;
+      default:
+        return false;
+      }
+      parsed.square[i] = Piece(piece | colour);
+      // Pawns off their starting rank have lost the double push
+      if (piece == Piece::Pawn)
+        parsed.square[i].hasMoved = colour == Piece::White ? i / 8 != 6 : i / 8 != 1;
+      i++;
+    }
+    if (i != 64)
+      return false;
+    if (side != "w" && side != "b")
+      return false;
+    parsed.turn = side == "w" ? Piece::White : Piece::Black;
+    parsed.castleableWK = GameRules::castling && castling.find('K') != string::npos;
+    parsed.castleableWQ = GameRules::castling && castling.find('Q') != string::npos;
+    parsed.castleableBK = GameRules::castling && castling.find('k') != string::npos;
+    parsed.castleableBQ = GameRules::castling && castling.find('q') != string::npos;
+    parsed.enPassantable = -1;
+    if (enPassant != "-")
+    {
+      if (enPassant.length() != 2 || enPassant[0] < 'a' || enPassant[0] > 'h' || enPassant[1] < '1' || enPassant[1] > '8')
+        return false;
+      parsed.enPassantable = (enPassant[0] - 'a') + 56 - (enPassant[1] - '1') * 8;
+    }
+    int clock;
+    if (fields >> clock && clock >= 0)
+      parsed.halfmove = clock;
+    *this = parsed;
+    return true;
+  }
+
   // Makes move given input, no move validation
   void makeMove(string move)
   {
     int from = (move[0] - 'a') + 56 - (move[1] - '1') * 8;
     int to = (move[2] - 'a') + 56 - (move[3] - '1') * 8;
+    halfmove = square[to].x != Piece::None || (square[from].x & 63) == Piece::Pawn ? 0 : halfmove + 1;
     square[to].x = square[from].x;
     square[to].hasMoved = true;
     square[from] = Piece(Piece::None);
+    turn = turn == Piece::White ? Piece::Black : Piece::White;
     // Reset en passantable flag
     if (enPassantable != to)
       enPassantable = -1;
@@ -82,6 +803,8 @@ public:
         square[to].x = Piece::Bishop | (square[to].x & Piece::White ? Piece::White : Piece::Black);
       else if (move[4] == 'n')
         square[to].x = Piece::Knight | (square[to].x & Piece::White ? Piece::White : Piece::Black);
+      else if (move[4] == 'k')
+        square[to].x = Piece::King | (square[to].x & Piece::White ? Piece::White : Piece::Black);
     }
     // Castling Case:
     else if (square[to].x == (Piece::King | Piece::Black))
@@ -153,59 +876,289 @@ public:
     return result;
   }
 
-  // Returns a vector of all possible moves for a given colour
-  vector<string> findPossibleMoves(uint8_t colour)
+  // Zobrist key of the position, computed from scratch
+  uint64_t hashKey()
   {
-    // moves has priority over secondary
-    // secondary only used if checked at start of term
-    // secondary stores non-take moves in this case
-    vector<string> moves;
-    vector<string> secondary;
-    int kingPos = kingFind(colour);
-    bool checked = inCheck(colour, toAlgebraic(kingPos) + toAlgebraic(kingPos), kingPos);
-    uint8_t opposite = colour == Piece::White ? Piece::Black : Piece::White;
+    uint64_t key = 0;
     for (int i = 0; i < 64; i++)
     {
-      if (!(square[i].x & colour))
-        continue;
-      uint8_t piece = square[i].x & 63;
-      if (piece == Piece::Bishop || piece == Piece::Queen)
+      if (square[i].x != Piece::None)
+        key ^= zobrist.pieces[Zobrist::index(square[i].x)][i];
+    }
+    key ^= zobrist.castling[castleableWK | castleableWQ << 1 | castleableBK << 2 | castleableBQ << 3];
+    if (enPassantable != -1)
+      key ^= zobrist.enPassant[enPassantable];
+    if (turn == Piece::Black)
+      key ^= zobrist.blackToMove;
+    return key;
+  }
+
+  // True if the move takes a piece, including en passant
+  bool isCapture(const string &move)
+  {
+    int from = (move[0] - 'a') + 56 - (move[1] - '1') * 8;
+    int to = (move[2] - 'a') + 56 - (move[3] - '1') * 8;
+    if (square[to].x != Piece::None)
+      return true;
+    return (square[from].x & 63) == Piece::Pawn && to == enPassantable && (to - from) % 8 != 0;
+  }
+
+  // Square of colour's least valuable piece attacking target, ignoring pieces on removed squares, or -1
+  int leastAttacker(int target, uint8_t colour, uint64_t removed, const EvalWeights &weights)
+  {
+    int best = -1, bestValue = 0;
+    auto consider = [&](int from, uint8_t types)
+    {
+      uint8_t x = square[from].x;
+      if (!(x & colour) || !(x & types) || (removed >> from & 1))
+        return;
+      int value = weights.value(x & 63);
+      if (best == -1 || value < bestValue)
       {
-        for (int j = 1; i + j * 9 < 64 && i % 8 + j < 8; j++)
-        {
-          if (square[i + j * 9].x & colour)
-            break;
-          if (square[i + j * 9].x & opposite)
-          {
-            moves.push_back(toAlgebraic(i) + toAlgebraic(i + j * 9));
-            break;
-          }
-          else
-            secondary.push_back(toAlgebraic(i) + toAlgebraic(i + j * 9));
-        }
-        for (int j = 1; i + j * 7 < 64 && i % 8 - j >= 0; j++)
-        {
-          if (square[i + j * 7].x & colour)
-            break;
-          if (square[i + j * 7].x & opposite)
-          {
-            moves.push_back(toAlgebraic(i) + toAlgebraic(i + j * 7));
-            break;
-          }
-          else
-            secondary.push_back(toAlgebraic(i) + toAlgebraic(i + j * 7));
-        }
-        for (int j = 1; i - j * 9 >= 0 && i % 8 - j >= 0; j++)
+        best = from;
+        bestValue = value;
+      }
+    };
+    int file = target % 8, rank = target / 8;
+    // White pawns capture towards lower indices, so they attack from the rank below
+    int pawnRank = colour == Piece::White ? rank + 1 : rank - 1;
+    if (pawnRank >= 0 && pawnRank < 8)
+    {
+      if (file > 0)
+        consider(pawnRank * 8 + file - 1, Piece::Pawn);
+      if (file < 7)
+        consider(pawnRank * 8 + file + 1, Piece::Pawn);
+    }
+    for (const int8_t *to = attackTables.knights[target]; *to != -1; to++)
+      consider(*to, Piece::Knight);
+    // Sliders see through removed pieces, which brings in attackers lined up behind them
+    for (int d = 0; d < 8; d++)
+    {
+      uint8_t sliders = d < 4 ? Piece::Bishop | Piece::Queen : Piece::Rook | Piece::Queen;
+      const int8_t *line = attackTables.lines[target][d];
+      for (int n = 0; line[n] != -1; n++)
+      {
+        int from = line[n];
+        if (square[from].x != Piece::None && !(removed >> from & 1))
         {
-          if (square[i - j * 9].x & colour)
-            break;
-          if (square[i - j * 9].x & opposite)
-          {
-            moves.push_back(toAlgebraic(i) + toAlgebraic(i - j * 9));
-            break;
-          }
-          else
-            secondary.push_back(toAlgebraic(i) + toAlgebraic(i - j * 9));
+          consider(from, n == 0 ? sliders | Piece::King : sliders);
+          break;
+        }
+      }
+    }
+    return best;
+  }
+
+  // White-relative material change of the capture sequence on target, colour capturing first
+  // with occupant standing on target; captures are compulsory, so neither side may stop
+  // while it still attacks the square, and each recaptures with its least valuable piece
+  int exchange(int target, uint8_t colour, uint8_t occupant, uint64_t removed, const EvalWeights &weights)
+  {
+    int score = 0;
+    int from;
+    while ((from = leastAttacker(target, colour, removed, weights)) != -1)
+    {
+      int value = weights.value(occupant & 63);
+      score += colour == Piece::White ? value : -value;
+      occupant = square[from].x;
+      removed |= 1ULL << from;
+      colour = colour == Piece::White ? Piece::Black : Piece::White;
+    }
+    return score;
+  }
+
+  // White-relative material change of move and the forced recaptures it sets off on its
+  // target square, resolved statically without making moves or generating move lists
+  int moveExchange(const string &move, const EvalWeights &weights = engineWeights)
+  {
+    int from = (move[0] - 'a') + 56 - (move[1] - '1') * 8;
+    int to = (move[2] - 'a') + 56 - (move[3] - '1') * 8;
+    uint8_t mover = square[from].x;
+    uint8_t colour = mover & Piece::White ? Piece::White : Piece::Black;
+    int score = 0;
+    if (isCapture(move))
+    {
+      int value = square[to].x != Piece::None ? weights.value(square[to].x & 63) : weights.pawn;
+      score += colour == Piece::White ? value : -value;
+    }
+    uint8_t occupant = mover;
+    if (move.length() == 5)
+      occupant = (uint8_t)(1 << string("pbnrqk").find(move[4])) | colour;
+    uint8_t opposite = colour == Piece::White ? Piece::Black : Piece::White;
+    return score + exchange(to, opposite, occupant, 1ULL << from, weights);
+  }
+
+  // True if colour can take a piece, en passant aside, without generating moves
+  bool canCapture(uint8_t colour)
+  {
+    uint8_t opposite = colour == Piece::White ? Piece::Black : Piece::White;
+    for (int i = 0; i < 64; i++)
+    {
+      if ((square[i].x & opposite) && leastAttacker(i, colour, 0, materialWeights) != -1)
+        return true;
+    }
+    return false;
+  }
+
+  // Returns the position as a FEN string
+  string toFen(int fullmove = 1)
+  {
+    const string letters = "pbnrqk";
+    string fen;
+    for (int rank = 0; rank < 8; rank++)
+    {
+      int empty = 0;
+      for (int file = 0; file < 8; file++)
+      {
+        uint8_t x = square[rank * 8 + file].x;
+        if (x == Piece::None)
+        {
+          empty++;
+          continue;
+        }
+        if (empty)
+          fen += (char)('0' + empty);
+        empty = 0;
+        char c = letters[__builtin_ctz(x & 63)];
+        fen += x & Piece::White ? (char)toupper(c) : c;
+      }
+      if (empty)
+        fen += (char)('0' + empty);
+      if (rank < 7)
+        fen += '/';
+    }
+    fen += turn == Piece::White ? " w " : " b ";
+    string castling;
+    if (castleableWK)
+      castling += 'K';
+    if (castleableWQ)
+      castling += 'Q';
+    if (castleableBK)
+      castling += 'k';
+    if (castleableBQ)
+      castling += 'q';
+    fen += castling == "" ? "-" : castling;
+    fen += " " + (enPassantable == -1 ? string("-") : toAlgebraic(enPassantable));
+    fen += " " + to_string(halfmove) + " " + to_string(fullmove);
+    return fen;
+  }
+
+  // Returns the move in standard algebraic notation, legal must hold every legal move
+  string toSan(const string &move, const vector<string> &legal)
+  {
+    int from = (move[0] - 'a') + 56 - (move[1] - '1') * 8;
+    int to = (move[2] - 'a') + 56 - (move[3] - '1') * 8;
+    uint8_t piece = square[from].x & 63;
+    if (piece == Piece::King && (to - from == 2 || from - to == 2))
+      return to > from ? "O-O" : "O-O-O";
+    string san;
+    bool capture = isCapture(move);
+    if (piece == Piece::Pawn)
+    {
+      if (capture)
+        san += move[0];
+    }
+    else
+    {
+      san += "PBNRQK"[__builtin_ctz(piece)];
+      // Disambiguate between identical pieces that reach the same square
+      bool sameFile = false, sameRank = false, ambiguous = false;
+      for (auto &other : legal)
+      {
+        if (other == move || other.substr(2, 2) != move.substr(2, 2))
+          continue;
+        int otherFrom = (other[0] - 'a') + 56 - (other[1] - '1') * 8;
+        if (otherFrom == from || (square[otherFrom].x & 63) != piece)
+          continue;
+        ambiguous = true;
+        if (other[0] == move[0])
+          sameFile = true;
+        if (other[1] == move[1])
+          sameRank = true;
+      }
+      if (ambiguous && (!sameFile || sameRank))
+        san += move[0];
+      if (ambiguous && sameFile)
+        san += move[1];
+    }
+    if (capture)
+      san += 'x';
+    san += move.substr(2, 2);
+    if (move.length() == 5)
+    {
+      san += '=';
+      san += (char)toupper(move[4]);
+    }
+    return san;
+  }
+
+  // Returns a vector of all possible moves for a given colour under the compiled-in rules
+  vector<string> findPossibleMoves(uint8_t colour)
+  {
+    return generateMoves<GameRules>(colour);
+  }
+
+  // Returns a vector of all possible moves for a given colour under Rules
+  template <class Rules>
+  vector<string> generateMoves(uint8_t colour)
+  {
+    // moves has priority over secondary
+    // secondary only used if checked at start of term
+    // secondary stores non-take moves in this case
+    vector<string> moves;
+    vector<string> secondary;
+    int kingPos = Rules::checks ? kingFind(colour) : -1;
+    // Without a king there is nothing to check
+    bool checked = kingPos != -1 && inCheck(colour, toAlgebraic(kingPos) + toAlgebraic(kingPos), kingPos);
+    uint8_t opposite = colour == Piece::White ? Piece::Black : Piece::White;
+    // Adds a pawn move to the last rank once per piece it may promote to
+    auto promote = [&](vector<string> &list, int from, int to)
+    {
+      for (const char *piece = Rules::promotions; *piece; piece++)
+        list.push_back(toAlgebraic(from) + toAlgebraic(to) + *piece);
+    };
+    for (int i = 0; i < 64; i++)
+    {
+      if (!(square[i].x & colour))
+        continue;
+      uint8_t piece = square[i].x & 63;
+      if (piece == Piece::Bishop || piece == Piece::Queen)
+      {
+        for (int j = 1; i + j * 9 < 64 && i % 8 + j < 8; j++)
+        {
+          if (square[i + j * 9].x & colour)
+            break;
+          if (square[i + j * 9].x & opposite)
+          {
+            moves.push_back(toAlgebraic(i) + toAlgebraic(i + j * 9));
+            break;
+          }
+          else
+            secondary.push_back(toAlgebraic(i) + toAlgebraic(i + j * 9));
+        }
+        for (int j = 1; i + j * 7 < 64 && i % 8 - j >= 0; j++)
+        {
+          if (square[i + j * 7].x & colour)
+            break;
+          if (square[i + j * 7].x & opposite)
+          {
+            moves.push_back(toAlgebraic(i) + toAlgebraic(i + j * 7));
+            break;
+          }
+          else
+            secondary.push_back(toAlgebraic(i) + toAlgebraic(i + j * 7));
+        }
+        for (int j = 1; i - j * 9 >= 0 && i % 8 - j >= 0; j++)
+        {
+          if (square[i - j * 9].x & colour)
+            break;
+          if (square[i - j * 9].x & opposite)
+          {
+            moves.push_back(toAlgebraic(i) + toAlgebraic(i - j * 9));
+            break;
+          }
+          else
+            secondary.push_back(toAlgebraic(i) + toAlgebraic(i - j * 9));
         }
         for (int j = 1; i - j * 7 >= 0 && i % 8 + j < 8; j++)
         {
@@ -280,7 +1233,7 @@ public:
 
             // Check for promotion
             if (i - 7 < 8)
-              moves.push_back(toAlgebraic(i) + toAlgebraic(i - 7) + 'q');
+              promote(moves, i, i - 7);
             else
               moves.push_back(toAlgebraic(i) + toAlgebraic(i - 7));
           }
@@ -289,7 +1242,7 @@ public:
 
             // Check for promotion
             if (i - 9 < 8)
-              moves.push_back(toAlgebraic(i) + toAlgebraic(i - 9) + 'q');
+              promote(moves, i, i - 9);
             else
               moves.push_back(toAlgebraic(i) + toAlgebraic(i - 9));
           }
@@ -297,7 +1250,7 @@ public:
           {
             // Check for promotion
             if (i - 8 < 8)
-              secondary.push_back(toAlgebraic(i) + toAlgebraic(i - 8) + 'q');
+              promote(secondary, i, i - 8);
             else
               secondary.push_back(toAlgebraic(i) + toAlgebraic(i - 8));
           }
@@ -313,7 +1266,7 @@ public:
 
             // Check for promotion
             if (i + 7 >= 56)
-              moves.push_back(toAlgebraic(i) + toAlgebraic(i + 7) + 'q');
+              promote(moves, i, i + 7);
             else
               moves.push_back(toAlgebraic(i) + toAlgebraic(i + 7));
           }
@@ -321,7 +1274,7 @@ public:
           {
             // Check for promotion
             if (i + 9 >= 56)
-              moves.push_back(toAlgebraic(i) + toAlgebraic(i + 9) + 'q');
+              promote(moves, i, i + 9);
             else
               moves.push_back(toAlgebraic(i) + toAlgebraic(i + 9));
           }
@@ -330,7 +1283,7 @@ public:
           {
             // Check for promotion
             if (i + 8 >= 56)
-              secondary.push_back(toAlgebraic(i) + toAlgebraic(i + 8) + 'q');
+              promote(secondary, i, i + 8);
             else
               secondary.push_back(toAlgebraic(i) + toAlgebraic(i + 8));
           }
@@ -505,7 +1458,7 @@ public:
             secondary.push_back(toAlgebraic(i) + toAlgebraic(i - 7));
         }
         // Castling
-        if (!checked)
+        if (Rules::castling && !checked)
         {
           // Queenside Black Castle
           if (castleableBQ && (square[3].x == Piece::None) && (square[2].x == Piece::None) && (square[1].x == Piece::None))
@@ -550,20 +1503,27 @@ public:
         }
       }
     }
+    if (!Rules::checks)
+    {
+      if (Rules::forcedCaptures)
+        return moves.size() > 0 ? moves : secondary;
+      moves.insert(moves.end(), secondary.begin(), secondary.end());
+      return moves;
+    }
     // Check Move validation
     vector<string> checkedMoves;
     for (auto move : moves)
     {
-      if (inCheck(colour, move, kingPos) == false)
+      if (kingPos == -1 || inCheck(colour, move, kingPos) == false)
         checkedMoves.emplace_back(move);
     }
 
     // Check if we need to go to secondary moves
-    if (checkedMoves.size() == 0)
+    if (checkedMoves.size() == 0 || !Rules::forcedCaptures)
     {
       for (auto move : secondary)
       {
-        if (inCheck(colour, move, kingPos) == false)
+        if (kingPos == -1 || inCheck(colour, move, kingPos) == false)
           checkedMoves.emplace_back(move);
       }
     }
@@ -782,7 +1742,7 @@ public:
   }
 
   // Evaluates the board and returns a score
-  int evaluate()
+  int evaluate(const EvalWeights &weights = engineWeights)
   {
     int score = 0;
     for (int i = 0; i < 64; i++)
@@ -792,40 +1752,40 @@ public:
       switch (square[i].x)
       {
       case Piece::Pawn | Piece::White:
-        score += 1;
+        score += weights.pawn;
         break;
       case Piece::Pawn | Piece::Black:
-        score -= 1;
+        score -= weights.pawn;
         break;
       case Piece::Bishop | Piece::White:
-        score += 3;
+        score += weights.bishop;
         break;
       case Piece::Bishop | Piece::Black:
-        score -= 3;
+        score -= weights.bishop;
         break;
       case Piece::Knight | Piece::White:
-        score += 3;
+        score += weights.knight;
         break;
       case Piece::Knight | Piece::Black:
-        score -= 3;
+        score -= weights.knight;
         break;
       case Piece::Rook | Piece::White:
-        score += 5;
+        score += weights.rook;
         break;
       case Piece::Rook | Piece::Black:
-        score -= 5;
+        score -= weights.rook;
         break;
       case Piece::Queen | Piece::White:
-        score += 9;
+        score += weights.queen;
         break;
       case Piece::Queen | Piece::Black:
-        score -= 9;
+        score -= weights.queen;
         break;
       case Piece::King | Piece::White:
-        score += 1000;
+        score += weights.king;
         break;
       case Piece::King | Piece::Black:
-        score -= 1000;
+        score -= weights.king;
         break;
       }
     }
@@ -835,7 +1795,7 @@ public:
   int kingFind(uint8_t colour)
   {
     int kingPos = -1;
-    for (int i = 0; i < 63; i++)
+    for (int i = 0; i < 64; i++)
     {
       if (square[i].x == colour + Piece::King)
       {
@@ -846,18 +1806,46 @@ public:
     return (kingPos);
   }
 
-  string bestMove(uint8_t colour, int depth)
+  // White-relative score when colour has no legal moves under Rules
+  template <class Rules>
+  int noMovesScore(uint8_t colour)
+  {
+    int kingPos = Rules::checks ? kingFind(colour) : -1;
+    bool checked = kingPos != -1 && inCheck(colour, toAlgebraic(kingPos) + toAlgebraic(kingPos), kingPos);
+    int score = Rules::noMovesScore(checked);
+    return colour == Piece::White ? score : -score;
+  }
+
+  // A child's decisive score is one ply further from the end as seen by its parent
+  static int fromChild(int score)
+  {
+    return score > DecisiveScore ? score - 1 : score < -DecisiveScore ? score + 1 : score;
+  }
+
+  // The parent's window expressed in the child's scores
+  static int toChild(int bound)
+  {
+    return bound > DecisiveScore ? bound + 1 : bound < -DecisiveScore ? bound - 1 : bound;
+  }
+
+  string bestMove(uint8_t colour, int depth, SearchContext *ctx = nullptr)
   {
     int bestScore = colour == Piece::White ? -100000 : 100000;
     string bestMove = "";
     vector<string> moves = findPossibleMoves(colour);
     if (moves.size() == 1)
       return moves[0];
+    if (ctx)
+      ctx->enterRoot(hashKey());
     for (int i = 0; i < moves.size(); i++)
     {
       Board board = *this;
       board.makeMove(moves[i]);
-      int score = board.minimax(depth, colour == Piece::White ? Piece::Black : Piece::White);
+      if (ctx)
+        ctx->ply = 1;
+      int score = fromChild(board.minimax(depth, colour == Piece::White ? Piece::Black : Piece::White, -100000, 100000, ctx));
+      if (ctx)
+        ctx->ply = 0;
       if (colour == Piece::White && score > bestScore)
       {
         bestScore = score;
@@ -872,111 +1860,3064 @@ public:
     return bestMove;
   }
 
-  int minimax(int depth, uint8_t colour, int alpha = -100000, int beta = 100000)
+  // Makes move followed by the child's line the principal variation at this ply
+  void updatePv(const string &move, SearchContext *ctx)
+  {
+    if (!ctx || ctx->ply + 1 >= SearchContext::MaxPly)
+      return;
+    vector<string> &line = ctx->pv[ctx->ply];
+    line.assign(1, move);
+    line.insert(line.end(), ctx->pv[ctx->ply + 1].begin(), ctx->pv[ctx->ply + 1].end());
+  }
+
+  // Rebuilds the principal variation after an exact table hit by following stored best moves
+  void hashPv(uint32_t move, int depth, SearchContext *ctx)
+  {
+    if (ctx->ply >= SearchContext::MaxPly)
+      return;
+    vector<string> &line = ctx->pv[ctx->ply];
+    Board board = *this;
+    while (move != 0 && line.size() < depth)
+    {
+      vector<string> moves = board.findPossibleMoves(board.turn);
+      auto found = find_if(moves.begin(), moves.end(), [&](const string &candidate)
+                           { return encodeMove(candidate) == move; });
+      if (found == moves.end())
+        break;
+      line.push_back(*found);
+      board.makeMove(*found);
+      int score, entryDepth;
+      TranspositionTable::Bound bound;
+      if (!ctx->table->probe(board.hashKey(), score, entryDepth, bound, move) || bound != TranspositionTable::Exact)
+        break;
+    }
+  }
+
+  int minimax(int depth, uint8_t colour, int alpha = -100000, int beta = 100000, SearchContext *ctx = nullptr)
   {
+    const EvalWeights &weights = ctx ? *ctx->weights : engineWeights;
+    const SearchOptions &options = ctx ? ctx->options : exhaustiveOptions;
+    if (ctx)
+    {
+      if (ctx->ply < SearchContext::MaxPly)
+        ctx->pv[ctx->ply].clear();
+      ctx->nodes++;
+      if (ctx->shouldStop())
+        return evaluate(weights);
+    }
+    // Repetitions and the 50-move rule are draws, and the subtree behind one is never searched;
+    // neither needs the move list, so they are scored first, even at the horizon or in a tablebase position
+    uint64_t key = ctx ? hashKey() : 0;
+    if (ctx && ctx->ply < SearchContext::MaxPly)
+    {
+      if (ctx->isRepetition(key, halfmove))
+        return 0;
+      ctx->keys[ctx->root + ctx->ply] = key;
+    }
+    if (halfmove >= 100)
+      return 0;
+    int tablebaseScore;
+    if (probeTablebaseScore(*this, tablebaseScore))
+      return tablebaseScore;
     if (depth == 0)
-      return evaluate();
+      return evaluate(weights);
+    // The exhaustive search without a context is the reference, so only searches with one use the table
+    // The bucket is fetched before generating moves so the memory access overlaps with the generator
+    if (ctx)
+      ctx->table->prefetch(key);
     vector<string> moves = findPossibleMoves(colour);
+    if (moves.size() == 0)
+      return noMovesScore<GameRules>(colour);
+    uint32_t hashMove = 0;
+    bool hashFirst = false;
+    if (ctx)
+    {
+      int hashScore, hashDepth;
+      TranspositionTable::Bound bound;
+      if (ctx->table->probe(key, hashScore, hashDepth, bound, hashMove))
+      {
+        if (hashDepth >= depth && (bound == TranspositionTable::Exact || (bound == TranspositionTable::Lower && hashScore >= beta) ||
+                                   (bound == TranspositionTable::Upper && hashScore <= alpha)))
+        {
+          if (bound == TranspositionTable::Exact)
+            hashPv(hashMove, hashDepth, ctx);
+          return hashScore;
+        }
+        // Search the stored best move first
+        for (int i = 0; i < moves.size(); i++)
+        {
+          if (encodeMove(moves[i]) == hashMove)
+          {
+            rotate(moves.begin(), moves.begin() + i, moves.begin() + i + 1);
+            hashFirst = true;
+            break;
+          }
+        }
+      }
+    }
+    // Mover-relative material change of a move and the recaptures it sets off
+    auto exchangeOf = [&](const string &move)
+    {
+      int score = moveExchange(move, weights);
+      return colour == Piece::White ? score : -score;
+    };
+    // Then order the rest by static exchange, best for the side to move first; near the leaves
+    // scoring every move costs about as much as the subtree it would save, so keep generator order
+    vector<int> exchanges;
+    if (ctx && depth >= 3 && moves.size() > 1)
+    {
+      vector<int> order(moves.size());
+      for (int i = 0; i < moves.size(); i++)
+      {
+        order[i] = i;
+        exchanges.push_back(exchangeOf(moves[i]));
+      }
+      stable_sort(order.begin() + hashFirst, order.end(), [&](int a, int b)
+                  { return exchanges[a] > exchanges[b]; });
+      vector<string> sorted;
+      vector<int> scores;
+      for (int i : order)
+      {
+        sorted.push_back(moves[i]);
+        scores.push_back(exchanges[i]);
+      }
+      moves.swap(sorted);
+      exchanges.swap(scores);
+    }
+    uint8_t opposite = colour == Piece::White ? Piece::Black : Piece::White;
+    // Searches a child one ply deeper
+    auto child = [&](Board &board, int childDepth, int childAlpha, int childBeta)
+    {
+      if (ctx)
+        ctx->ply++;
+      int score = fromChild(board.minimax(childDepth, opposite, toChild(childAlpha), toChild(childBeta), ctx));
+      if (ctx)
+        ctx->ply--;
+      return score;
+    };
+    // Captures are compulsory, so either every move is a capture or none is; a promotion
+    // changes the material as much as a capture, so nodes with one are not quiet either
+    bool quiet = moves.size() > 0 && !isCapture(moves[0]) &&
+                 none_of(moves.begin(), moves.end(), [](const string &move)
+                         { return move.length() == 5; });
+    // Moves after the first that lose more than the margin to forced recaptures are not searched
+    // near the leaves
+    auto losingExchange = [&](int i)
+    {
+      if (!quiet || !options.exchangePruning || depth > options.exchangeDepth || i == 0)
+        return false;
+      return (i < exchanges.size() ? exchanges[i] : exchangeOf(moves[i])) < -options.exchangeMargin;
+    };
+    int staticEval = quiet && (options.futility || options.razoring) ? evaluate(weights) : 0;
+    // Stores a finished node, unless the search was cut short and its score cannot be trusted
+    int alphaOrig = alpha, betaOrig = beta;
+    auto record = [&](int bestScore, int best)
+    {
+      if (ctx && !ctx->stopped)
+      {
+        TranspositionTable::Bound bound = bestScore <= alphaOrig ? TranspositionTable::Upper : bestScore >= betaOrig ? TranspositionTable::Lower
+                                                                                                                    : TranspositionTable::Exact;
+        ctx->table->store(key, bestScore, depth, bound, best >= 0 ? encodeMove(moves[best]) : 0);
+      }
+      return bestScore;
+    };
     if (colour == Piece::White)
     {
+      if (quiet && options.razoring && depth == 2 && staticEval + options.razorMargin <= alpha)
+        depth = 1;
+      if (quiet && options.futility && depth == 1 && staticEval + options.futilityMargin <= alpha)
+        return staticEval + options.futilityMargin;
       int bestScore = -100000;
+      int best = -1;
       for (int i = 0; i < moves.size(); i++)
       {
+        if (losingExchange(i))
+          continue;
         Board board = *this;
         board.makeMove(moves[i]);
-        int score = board.minimax(depth - 1, Piece::Black, alpha, beta);
-        bestScore = max(bestScore, score);
+        int score;
+        if (quiet && options.lmr && depth >= options.lmrMinDepth && i >= options.lmrMinMoves)
+        {
+          score = child(board, max(depth - 1 - options.lmrReduction, 0), alpha, alpha + 1);
+          if (score > alpha)
+            score = child(board, depth - 1, alpha, beta);
+        }
+        else
+          score = child(board, depth - 1, alpha, beta);
+        if (score > alpha)
+          updatePv(moves[i], ctx);
+        if (best == -1 || score > bestScore)
+        {
+          bestScore = score;
+          best = i;
+        }
         alpha = max(alpha, score);
         if (beta <= alpha)
         {
           break;
         }
       }
-      return bestScore;
+      return record(bestScore, best);
     }
     else
     {
+      if (quiet && options.razoring && depth == 2 && staticEval - options.razorMargin >= beta)
+        depth = 1;
+      if (quiet && options.futility && depth == 1 && staticEval - options.futilityMargin >= beta)
+        return staticEval - options.futilityMargin;
       int bestScore = 100000;
+      int best = -1;
       for (int i = 0; i < moves.size(); i++)
       {
+        if (losingExchange(i))
+          continue;
         Board board = *this;
         board.makeMove(moves[i]);
-        int score = board.minimax(depth - 1, Piece::White, alpha, beta);
-        bestScore = min(bestScore, score);
+        int score;
+        if (quiet && options.lmr && depth >= options.lmrMinDepth && i >= options.lmrMinMoves)
+        {
+          score = child(board, max(depth - 1 - options.lmrReduction, 0), beta - 1, beta);
+          if (score < beta)
+            score = child(board, depth - 1, alpha, beta);
+        }
+        else
+          score = child(board, depth - 1, alpha, beta);
+        if (score < beta)
+          updatePv(moves[i], ctx);
+        if (best == -1 || score < bestScore)
+        {
+          bestScore = score;
+          best = i;
+        }
         beta = min(beta, score);
         if (beta <= alpha)
         {
           break;
         }
       }
-      return bestScore;
+      return record(bestScore, best);
     }
   }
-};
-
-void aiMove(Board &board, uint8_t ai, int depth)
-{
-  vector<string> moves = board.findPossibleMoves(ai);
-  int kingPos = board.kingFind(ai);
-  if (moves.size() == 0)
-    return;
-  string bestMove = board.bestMove(ai, depth);
-  if (bestMove == "")
-    bestMove = moves[0];
-  cout << bestMove << endl;
-  board.makeMove(bestMove);
-}
-void playerMove(Board &board)
-{
-  string move;
-  cin >> move;
-  board.makeMove(move);
-}
-void moveIterator(int argc, char *argv[])
-{
-  Board board;
-  string move;
-  string aiColorStr = argv[1];
-  uint8_t ai = aiColorStr == "white" ? Piece::White : Piece::Black;
-  int moveCounter = 0;
-  int depth = 5;
 
-  if (ai == Piece::White) // ai is white, player is black
+  // Iterative deepening search up to maxDepth plies (including the root move)
+  // Stops early once ctx runs out of time and returns the last completed iteration
+  SearchResult search(uint8_t colour, int maxDepth, SearchContext &ctx)
   {
-    aiMove(board, ai, depth);
-    moveCounter++;
-    if (moveCounter >= 7)
+    vector<SearchResult> lines = searchMultiPV(colour, maxDepth, 1, ctx);
+    if (lines.size() == 0)
     {
-      moveCounter = 0;
-      depth++;
-      if (depth == 9)
-        depth = 8;
+      SearchResult result;
+      result.nodes = ctx.nodes;
+      return result;
     }
+    return lines[0];
   }
-  while (true)
+
+  // Iterative deepening search returning the best count root moves, ranked, with their lines
+  // Each root move only has to beat the count-th best score so far, so the moves outside the
+  // top count are refuted with the same narrow window a single-line search would use
+  // report, if given, is called with the ranked lines after every completed depth
+  vector<SearchResult> searchMultiPV(uint8_t colour, int maxDepth, int count, SearchContext &ctx,
+                                     function<void(const vector<SearchResult> &)> report = nullptr)
   {
-    playerMove(board);
-    moveCounter++;
-    if (moveCounter >= 7)
+    vector<SearchResult> lines;
+    vector<string> moves = findPossibleMoves(colour);
+    if (moves.size() == 0)
+      return lines;
+    count = max(1, min(count, (int)moves.size()));
+    ctx.enterRoot(hashKey());
+    for (int i = 0; i < count; i++)
     {
-      moveCounter = 0;
-      depth++;
-      if (depth == 9)
-        depth = 8;
+      SearchResult line;
+      line.move = moves[i];
+      line.pv.push_back(moves[i]);
+      lines.push_back(line);
     }
-    aiMove(board, ai, depth);
-    moveCounter++;
-    if (moveCounter >= 7)
+    bool white = colour == Piece::White;
+    for (int depth = 1; depth <= maxDepth; depth++)
     {
-      moveCounter = 0;
-      depth++;
-      if (depth == 9)
-        depth = 8;
+      vector<SearchResult> ranked;
+      for (int i = 0; i < moves.size(); i++)
+      {
+        Board board = *this;
+        board.makeMove(moves[i]);
+        int bound = ranked.size() < count ? (white ? -100000 : 100000) : ranked.back().score;
+        ctx.ply = 1;
+        int score = fromChild(white ? board.minimax(depth - 1, Piece::Black, toChild(bound), 100000, &ctx)
+                                    : board.minimax(depth - 1, Piece::White, -100000, toChild(bound), &ctx));
+        ctx.ply = 0;
+        if (ctx.stopped)
+          break;
+        if (ranked.size() == count && (white ? score <= bound : score >= bound))
+          continue;
+        SearchResult line;
+        line.move = moves[i];
+        line.score = score;
+        line.depth = depth;
+        line.pv.push_back(moves[i]);
+        line.pv.insert(line.pv.end(), ctx.pv[1].begin(), ctx.pv[1].end());
+        // Insert after every line that scores at least as well, keeping the earlier move on ties
+        int at = ranked.size();
+        while (at > 0 && (white ? ranked[at - 1].score < score : ranked[at - 1].score > score))
+          at--;
+        ranked.insert(ranked.begin() + at, line);
+        if (ranked.size() > count)
+          ranked.pop_back();
+      }
+      if (ctx.stopped)
+        break;
+      lines = ranked;
+      for (auto &line : lines)
+        line.nodes = ctx.nodes;
+      if (report)
+        report(lines);
+      // Search the ranked moves first, in order, in the next iteration
+      for (int i = 0; i < lines.size(); i++)
+        swap(moves[i], *find(moves.begin() + i, moves.end(), lines[i].move));
     }
+    for (auto &line : lines)
+      line.nodes = ctx.nodes;
+    return lines;
   }
-}
-int main(int argc, char *argv[])
+};
+
+// Depth-first proof-number search (df-pn) for proving forced antichess wins
+// Numbers are kept from the side to move's point of view (phi/delta) so both
+// node types are handled alike: phi is the cost of proving the side to move
+// gets its way, delta the cost of refuting that. The side to move wins when
+// it has no legal moves, and positions repeated on the current path count as
+// a failure for the attacker.
+class ProofNumberSolver
 {
+public:
+  enum Result
+  {
+    Unknown,
+    Proven,
+    Disproven
+  };
+
+  uint64_t nodes = 0;
+
+  ProofNumberSolver(size_t hashMB, uint64_t maxNodes) : maxNodes(maxNodes)
+  {
+    // At least one bucket, however small the size asked for
+    size_t entries = BucketSize;
+    while (entries * 2 * sizeof(Entry) <= hashMB * 1024 * 1024)
+      entries *= 2;
+    table.assign(entries, Entry());
+    mask = entries - 1;
+  }
+
+  // Tries to prove that attacker wins from board, within the node budget
+  // Entries only mean something for one attacker, and repetitions make them depend on
+  // the path from the root, so the table starts empty for a new attacker or root
+  Result solve(Board board, uint8_t attacker)
+  {
+    uint64_t key = board.hashKey();
+    if (attacker != this->attacker || key != root)
+      fill(table.begin(), table.end(), Entry());
+    this->attacker = attacker;
+    root = key;
+    nodes = 0;
+    aborted = false;
+    path.clear();
+    mid(board, key, INF, INF);
+    uint32_t phi, delta, work;
+    lookup(key, phi, delta, work);
+    if (phi != 0 && delta != 0)
+      return Unknown;
+    return (phi == 0) == (board.turn == attacker) ? Proven : Disproven;
+  }
+
+  // Follows a proven result through the table: the attacker takes the quickest
+  // proven win and the defender the reply that took the most work to refute
+  vector<string> winningLine(Board board, int maxPlies = 200)
+  {
+    vector<string> line;
+    vector<uint64_t> seen;
+    while (line.size() < maxPlies)
+    {
+      vector<string> moves = board.findPossibleMoves(board.turn);
+      if (moves.size() == 0)
+        break;
+      bool attacking = board.turn == attacker;
+      string chosen;
+      uint32_t chosenWork = 0;
+      for (auto &move : moves)
+      {
+        Board child = board;
+        child.makeMove(move);
+        uint32_t phi, delta, work;
+        if (!lookup(child.hashKey(), phi, delta, work))
+          continue;
+        // The attacker needs a child the defender cannot escape, the defender only has such children
+        if (attacking ? delta != 0 : phi != 0)
+          continue;
+        if (chosen == "" || (attacking ? work < chosenWork : work > chosenWork))
+        {
+          chosen = move;
+          chosenWork = work;
+        }
+      }
+      uint64_t key = board.hashKey();
+      if (chosen == "" || find(seen.begin(), seen.end(), key) != seen.end())
+        break;
+      seen.push_back(key);
+      line.push_back(chosen);
+      board.makeMove(chosen);
+    }
+    return line;
+  }
+
+private:
+  struct Entry
+  {
+    uint64_t key = 0;
+    uint32_t phi = 0;
+    uint32_t delta = 0;
+    uint32_t work = 0;
+  };
+
+  static const uint32_t INF = 100000000;
+  static const int BucketSize = 4;
+  vector<Entry> table;
+  size_t mask;
+  uint64_t maxNodes;
+  uint8_t attacker = Piece::White;
+  uint64_t root = 0;
+  bool aborted = false;
+  vector<uint64_t> path;
+
+  // Unknown positions start at phi = delta = 1
+  bool lookup(uint64_t key, uint32_t &phi, uint32_t &delta, uint32_t &work)
+  {
+    size_t base = key & mask & ~(size_t)(BucketSize - 1);
+    for (int i = 0; i < BucketSize; i++)
+    {
+      Entry &entry = table[base + i];
+      if (entry.key == key && entry.work != 0)
+      {
+        phi = entry.phi;
+        delta = entry.delta;
+        work = entry.work;
+        return true;
+      }
+    }
+    phi = 1;
+    delta = 1;
+    work = 0;
+    return false;
+  }
+
+  // Overwrites the same position, otherwise the entry that cost the least work
+  void store(uint64_t key, uint32_t phi, uint32_t delta, uint64_t work)
+  {
+    size_t base = key & mask & ~(size_t)(BucketSize - 1);
+    Entry *victim = &table[base];
+    for (int i = 0; i < BucketSize; i++)
+    {
+      Entry &entry = table[base + i];
+      if (entry.key == key)
+      {
+        victim = &entry;
+        break;
+      }
+      if (entry.work < victim->work)
+        victim = &entry;
+    }
+    victim->key = key;
+    victim->phi = phi;
+    victim->delta = delta;
+    victim->work = (uint32_t)min(work, (uint64_t)UINT32_MAX);
+  }
+
+  // Values of a child position, repetitions count as a failure for the attacker
+  void childValues(const Board &child, uint64_t key, uint32_t &phi, uint32_t &delta)
+  {
+    if (find(path.begin(), path.end(), key) != path.end())
+    {
+      phi = child.turn == attacker ? INF : 0;
+      delta = child.turn == attacker ? 0 : INF;
+      return;
+    }
+    uint32_t work;
+    lookup(key, phi, delta, work);
+  }
+
+  // Expands board until its phi or delta reaches the given thresholds
+  void mid(Board &board, uint64_t key, uint32_t thphi, uint32_t thdelta)
+  {
+    nodes++;
+    if (nodes >= maxNodes)
+    {
+      aborted = true;
+      return;
+    }
+    vector<string> moves = board.findPossibleMoves(board.turn);
+    if (moves.size() == 0)
+    {
+      store(key, 0, INF, 1);
+      return;
+    }
+    vector<Board> children(moves.size(), board);
+    vector<uint64_t> keys(moves.size());
+    for (int i = 0; i < moves.size(); i++)
+    {
+      children[i].makeMove(moves[i]);
+      keys[i] = children[i].hashKey();
+    }
+    uint64_t startNodes = nodes;
+    uint32_t phi, delta;
+    path.push_back(key);
+    while (true)
+    {
+      // phi = min child delta, delta = sum of child phi
+      phi = INF;
+      uint64_t sum = 0;
+      bool disproven = false;
+      int best = 0;
+      uint32_t bestPhi = 0, secondDelta = INF;
+      for (int i = 0; i < children.size(); i++)
+      {
+        uint32_t childPhi, childDelta;
+        childValues(children[i], keys[i], childPhi, childDelta);
+        sum += childPhi;
+        disproven |= childPhi == INF;
+        if (childDelta < phi)
+        {
+          secondDelta = phi;
+          phi = childDelta;
+          best = i;
+          bestPhi = childPhi;
+        }
+        else if (childDelta < secondDelta)
+          secondDelta = childDelta;
+      }
+      // Only a disproven child makes delta infinite, many expensive ones merely approach it
+      delta = disproven ? INF : (uint32_t)min(sum, (uint64_t)INF - 1);
+      if (phi >= thphi || delta >= thdelta || aborted)
+        break;
+      uint64_t childThphi = (uint64_t)thdelta - delta + bestPhi;
+      uint32_t childThdelta = min(thphi, secondDelta == INF ? INF : secondDelta + 1);
+      mid(children[best], keys[best], (uint32_t)min(childThphi, (uint64_t)INF), childThdelta);
+    }
+    path.pop_back();
+    store(key, phi, delta, nodes - startNodes + 1);
+  }
+};
+
+// Win/loss/draw plus distance tablebases for positions with few pieces
+// Every material signature has its own file: a header then one byte per
+// position. Positions are indexed by side to move and piece squares, with
+// files mirrored so the first piece stands on files a-d, and only one colour
+// orientation of each material is stored. Tables hold no castling rights and
+// ignore en passant.
+class Tablebases
+{
+public:
+  // Byte values: 0 draw, 1..127 win in (v - 1) plies, 128..254 loss in (v - 128) plies
+  const static uint8_t Draw = 0;
+  const static uint8_t WinBase = 1;
+  const static uint8_t LossBase = 128;
+  const static uint8_t Invalid = 255;
+  const static int MaxDistance = 126;
+  // Version 2: built with king promotions and without check rules
+  const static uint32_t Version = 2;
+
+  struct Header
+  {
+    char magic[4];
+    uint32_t version;
+    uint64_t material;
+    uint64_t size;
+  };
+
+  int maxPieces = 0;
+
+  ~Tablebases()
+  {
+    for (auto &entry : tables)
+      munmap((void *)entry.second.mapping, entry.second.length);
+  }
+
+  // Maps every .actb file in dir, returns the number of tables found
+  int load(const string &dir)
+  {
+    DIR *handle = opendir(dir.c_str());
+    if (!handle)
+      return 0;
+    int found = 0;
+    while (dirent *entry = readdir(handle))
+    {
+      string name = entry->d_name;
+      if (name.size() > 5 && name.substr(name.size() - 5) == ".actb" && loadFile(dir + "/" + name))
+        found++;
+    }
+    closedir(handle);
+    return found;
+  }
+
+  // Maps a single table file, checking its header
+  bool loadFile(const string &path)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(Header))
+    {
+      close(fd);
+      return false;
+    }
+    void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+      return false;
+    const Header *header = (const Header *)mapping;
+    if (string(header->magic, 4) != "ACTB" || header->version != Version ||
+        header->size + sizeof(Header) != (uint64_t)info.st_size || tables.count(header->material))
+    {
+      munmap(mapping, info.st_size);
+      return false;
+    }
+    Table table;
+    table.mapping = (const uint8_t *)mapping;
+    table.length = info.st_size;
+    table.data = table.mapping + sizeof(Header);
+    table.size = header->size;
+    tables[header->material] = table;
+    maxPieces = max(maxPieces, pieceCount(header->material));
+    return true;
+  }
+
+  bool has(uint64_t material) const
+  {
+    return tables.count(material) > 0;
+  }
+
+  // Looks up the raw byte for board, false if no table covers it
+  bool probe(const Board &board, uint8_t &value) const
+  {
+    if (maxPieces == 0 || board.enPassantable != -1 || board.castleableWK || board.castleableWQ || board.castleableBK || board.castleableBQ)
+      return false;
+    uint64_t material = materialKey(board);
+    if (pieceCount(material) > maxPieces)
+      return false;
+    auto found = tables.find(material);
+    if (found != tables.end())
+    {
+      value = found->second.data[index(board)];
+      return value != Invalid;
+    }
+    found = tables.find(flipMaterial(material));
+    if (found == tables.end())
+      return false;
+    value = found->second.data[index(flipColours(board))];
+    return value != Invalid;
+  }
+
+  // Four bits per piece kind, kinds numbered as in Zobrist::index
+  static uint64_t materialKey(const Board &board)
+  {
+    uint64_t key = 0;
+    for (int i = 0; i < 64; i++)
+    {
+      if (board.square[i].x != Piece::None)
+        key += 1ULL << (Zobrist::index(board.square[i].x) * 4);
+    }
+    return key;
+  }
+
+  static int count(uint64_t material, int kind)
+  {
+    return (material >> (kind * 4)) & 15;
+  }
+
+  static int pieceCount(uint64_t material)
+  {
+    int total = 0;
+    for (int kind = 0; kind < 12; kind++)
+      total += count(material, kind);
+    return total;
+  }
+
+  // Swaps the white and black counts
+  static uint64_t flipMaterial(uint64_t material)
+  {
+    uint64_t flipped = 0;
+    for (int kind = 0; kind < 12; kind++)
+      flipped += (uint64_t)count(material, kind) << ((kind ^ 1) * 4);
+    return flipped;
+  }
+
+  // The orientation a material is stored under
+  static uint64_t canonical(uint64_t material)
+  {
+    return max(material, flipMaterial(material));
+  }
+
+  // Mirrors ranks and swaps colours, so black's pieces become white's
+  static Board flipColours(const Board &board)
+  {
+    Board flipped = board;
+    for (int i = 0; i < 64; i++)
+    {
+      Piece piece = board.square[i ^ 56];
+      if (piece.x != Piece::None)
+        piece.x = (piece.x & 63) | (piece.x & Piece::White ? Piece::Black : Piece::White);
+      flipped.square[i] = piece;
+    }
+    flipped.turn = board.turn == Piece::White ? Piece::Black : Piece::White;
+    flipped.enPassantable = board.enPassantable == -1 ? -1 : board.enPassantable ^ 56;
+    return flipped;
+  }
+
+  // Name such as "KRvKP", white pieces first
+  static string name(uint64_t material)
+  {
+    const string order = "KQRBNP";
+    const int kinds[6] = {10, 8, 6, 2, 4, 0};
+    string result;
+    for (int colour = 0; colour < 2; colour++)
+    {
+      if (colour == 1)
+        result += 'v';
+      for (int i = 0; i < 6; i++)
+        result += string(count(material, kinds[i] + colour), order[i]);
+    }
+    return result;
+  }
+
+  // Parses a name such as "KRvKP", returns 0 if malformed
+  static uint64_t parseName(const string &name)
+  {
+    const string order = "KQRBNP";
+    const int kinds[6] = {10, 8, 6, 2, 4, 0};
+    size_t split = name.find('v');
+    if (split == string::npos)
+      return 0;
+    uint64_t material = 0;
+    for (size_t i = 0; i < name.size(); i++)
+    {
+      if (i == split)
+        continue;
+      size_t type = order.find(name[i]);
+      if (type == string::npos)
+        return 0;
+      material += 1ULL << ((kinds[type] + (i > split ? 1 : 0)) * 4);
+    }
+    return material;
+  }
+
+  // Entries in the table of a material with the given number of pieces
+  static uint64_t tableSize(int pieces)
+  {
+    uint64_t size = 2 * 32;
+    for (int i = 1; i < pieces; i++)
+      size *= 64;
+    return size;
+  }
+
+  // Index of board in its material's table, the board must be in the stored orientation
+  static uint64_t index(const Board &board)
+  {
+    int squares[12][16];
+    int counts[12] = {0};
+    for (int i = 0; i < 64; i++)
+    {
+      if (board.square[i].x == Piece::None)
+        continue;
+      int kind = Zobrist::index(board.square[i].x);
+      squares[kind][counts[kind]++] = i;
+    }
+    uint64_t turn = board.turn == Piece::Black ? 1 : 0;
+    uint64_t plain = encode(squares, counts);
+    // Mirror files and restore square order within each kind, the smaller
+    // valid encoding is the position's index
+    for (int kind = 0; kind < 12; kind++)
+    {
+      for (int i = 0; i < counts[kind]; i++)
+        squares[kind][i] ^= 7;
+      sort(squares[kind], squares[kind] + counts[kind]);
+    }
+    uint64_t mirrored = encode(squares, counts);
+    return min(plain, mirrored) * 2 + turn;
+  }
+
+private:
+  // Encodes piece squares with the first piece in base 32, or UINT64_MAX when it is on files e-h
+  static uint64_t encode(int squares[12][16], const int counts[12])
+  {
+    int first = 0;
+    while (counts[first] == 0)
+      first++;
+    if (squares[first][0] % 8 >= 4)
+      return UINT64_MAX;
+    uint64_t result = 0;
+    for (int kind = 11; kind >= 0; kind--)
+    {
+      for (int i = counts[kind] - 1; i >= 0; i--)
+      {
+        if (kind == first && i == 0)
+          result = result * 32 + squares[kind][i] / 8 * 4 + squares[kind][i] % 8;
+        else
+          result = result * 64 + squares[kind][i];
+      }
+    }
+    return result;
+  }
+
+  struct Table
+  {
+    const uint8_t *mapping;
+    size_t length;
+    const uint8_t *data;
+    uint64_t size;
+  };
+
+  unordered_map<uint64_t, Table> tables;
+};
+
+// Shared read-only by every search thread once loaded at startup
+Tablebases tablebases;
+
+bool probeTablebaseScore(Board &board, int &score)
+{
+  uint8_t value;
+  if (!tablebases.probe(board, value))
+    return false;
+  if (value == Tablebases::Draw)
+    score = 0;
+  else if (value < Tablebases::LossBase)
+    score = 50000 - (value - Tablebases::WinBase);
+  else
+    score = -50000 + (value - Tablebases::LossBase);
+  if (board.turn == Piece::Black)
+    score = -score;
+  return true;
+}
+
+// Builds tablebases by retrograde analysis over the engine's own move generator
+// An initial forward pass scores moves that leave the table (captures and
+// promotions) from smaller tables, then results are propagated backwards one
+// distance at a time through un-moves, using every thread in each pass
+class TablebaseGenerator
+{
+public:
+  TablebaseGenerator(Tablebases &tables, const string &dir, int threads) : tables(tables), dir(dir), threads(threads) {}
+
+  // Generates the table for material and, first, every table it depends on
+  bool generate(uint64_t material)
+  {
+    material = Tablebases::canonical(material);
+    if (tables.has(material))
+      return true;
+    for (auto dependency : dependencies(material))
+    {
+      if (!generate(dependency))
+        return false;
+    }
+    return build(material);
+  }
+
+  // Every material with 2..pieces pieces and at least one piece per side
+  static vector<uint64_t> allMaterials(int pieces)
+  {
+    vector<uint64_t> sides[6];
+    // sides[n] holds every white-only material with n pieces
+    sides[0].push_back(0);
+    for (int n = 1; n < 6 && n < pieces; n++)
+    {
+      for (auto smaller : sides[n - 1])
+      {
+        // Add pieces in non-decreasing kind order to avoid duplicates
+        int last = 0;
+        for (int kind = 0; kind < 12; kind += 2)
+        {
+          if (Tablebases::count(smaller, kind))
+            last = kind;
+        }
+        for (int kind = last; kind < 12; kind += 2)
+          sides[n].push_back(smaller + (1ULL << (kind * 4)));
+      }
+    }
+    vector<uint64_t> materials;
+    for (int white = 1; white < pieces && white < 6; white++)
+    {
+      for (int black = 1; white + black <= pieces && black < 6; black++)
+      {
+        for (auto w : sides[white])
+        {
+          for (auto b : sides[black])
+          {
+            uint64_t material = w + (b << 4);
+            if (material == Tablebases::canonical(material))
+              materials.push_back(material);
+          }
+        }
+      }
+    }
+    return materials;
+  }
+
+private:
+  // Packed generation state, two bytes per position: the result in the top two bits, then the
+  // distance for decided positions, or for undecided ones a blocked flag (some move leaves the
+  // table for a draw) and the number of children inside the table not yet known to be wins
+  const static uint16_t Unknown = 0;
+  const static uint16_t Win = 1;
+  const static uint16_t Loss = 2;
+  const static uint16_t Broken = 3;
+  const static uint16_t Blocked = 1 << 13;
+  const static uint16_t MaxState = (1 << 14) - 1;
+  const static int None = 0xFFFF;
+
+  Tablebases &tables;
+  string dir;
+  int threads;
+  vector<uint16_t> state;
+  atomic<int> maxDistance{0};
+
+  static uint16_t pack(uint16_t result, int distance)
+  {
+    return result << 14 | min(distance, (int)MaxState);
+  }
+
+  // Materials reachable by one capture or promotion
+  static vector<uint64_t> dependencies(uint64_t material)
+  {
+    vector<uint64_t> result;
+    for (int kind = 0; kind < 12; kind++)
+    {
+      if (!Tablebases::count(material, kind))
+        continue;
+      uint64_t captured = material - (1ULL << (kind * 4));
+      int colour = kind & 1;
+      bool sideLeft = false;
+      for (int other = colour; other < 12; other += 2)
+        sideLeft |= Tablebases::count(captured, other) > 0;
+      if (sideLeft)
+        result.push_back(Tablebases::canonical(captured));
+      if (kind / 2 == 0)
+      {
+        for (int promoted = 2; promoted < 12; promoted += 2)
+          result.push_back(Tablebases::canonical(captured + (1ULL << ((promoted + colour) * 4))));
+      }
+    }
+    return result;
+  }
+
+  // Runs body(begin, end) over [0, size) in chunks on every thread
+  template <typename Body>
+  void parallelFor(uint64_t size, Body body)
+  {
+    atomic<uint64_t> next{0};
+    const uint64_t chunk = 4096;
+    vector<thread> workers;
+    for (int i = 0; i < threads; i++)
+    {
+      workers.emplace_back([&]
+                           {
+        uint64_t begin;
+        while ((begin = next.fetch_add(chunk)) < size)
+          body(begin, min(begin + chunk, size)); });
+    }
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  // Builds the board for an index, false if it is illegal or not the canonical index
+  static bool decode(uint64_t index, const vector<int> &kinds, Board &board)
+  {
+    for (int i = 0; i < 64; i++)
+      board.square[i] = Piece(Piece::None);
+    board.castleableBQ = board.castleableBK = board.castleableWQ = board.castleableWK = false;
+    board.enPassantable = -1;
+    board.turn = index & 1 ? Piece::Black : Piece::White;
+    uint64_t rest = index >> 1;
+    for (int i = 0; i < kinds.size(); i++)
+    {
+      int sq;
+      if (i == 0)
+      {
+        sq = rest % 32 / 4 * 8 + rest % 4;
+        rest /= 32;
+      }
+      else
+      {
+        sq = rest % 64;
+        rest /= 64;
+      }
+      if (board.square[sq].x != Piece::None)
+        return false;
+      uint8_t colour = kinds[i] & 1 ? Piece::Black : Piece::White;
+      uint8_t type = 1 << (kinds[i] / 2);
+      if (type == Piece::Pawn && (sq < 8 || sq >= 56))
+        return false;
+      board.square[sq] = Piece(type | colour);
+      if (type == Piece::Pawn)
+        board.square[sq].hasMoved = colour == Piece::White ? sq / 8 != 6 : sq / 8 != 1;
+    }
+    return Tablebases::index(board) == index;
+  }
+
+  // The raw byte for a position outside the table being built
+  bool external(Board &child, uint8_t &value)
+  {
+    bool hasPieces = false;
+    for (int i = 0; i < 64 && !hasPieces; i++)
+      hasPieces = child.square[i].x & child.turn;
+    if (!hasPieces)
+    {
+      value = Tablebases::WinBase;
+      return true;
+    }
+    return tables.probe(child, value);
+  }
+
+  // Scores the moves of board that leave the table and collects the distinct children inside it:
+  // bestWin is the quickest win out of the table, longestLoss the slowest loss, and blocked is
+  // set when a move leaves for a draw or a position no table covers; returns the number of moves
+  int scoreMoves(Board &board, uint64_t material, vector<uint64_t> &inside, int &bestWin, int &longestLoss, bool &blocked)
+  {
+    bestWin = None;
+    longestLoss = 0;
+    blocked = false;
+    vector<string> moves = board.findPossibleMoves(board.turn);
+    for (auto &move : moves)
+    {
+      Board child = board;
+      child.makeMove(move);
+      child.enPassantable = -1;
+      if (Tablebases::materialKey(child) == material)
+      {
+        uint64_t childIndex = Tablebases::index(child);
+        if (find(inside.begin(), inside.end(), childIndex) == inside.end())
+          inside.push_back(childIndex);
+        continue;
+      }
+      uint8_t value;
+      if (!external(child, value) || value == Tablebases::Draw)
+        blocked = true;
+      else if (value >= Tablebases::LossBase)
+        bestWin = min(bestWin, value - Tablebases::LossBase + 1);
+      else
+        longestLoss = max(longestLoss, value - Tablebases::WinBase + 1);
+    }
+    return moves.size();
+  }
+
+  // Sets a win unless a shorter one is already known
+  void offerWin(uint64_t index, int distance)
+  {
+    uint16_t current = __atomic_load_n(&state[index], __ATOMIC_RELAXED);
+    while ((current >> 14 == Unknown || (current >> 14 == Win && (current & MaxState) > distance)))
+    {
+      if (__atomic_compare_exchange_n(&state[index], &current, pack(Win, distance), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      {
+        raiseMaxDistance(distance);
+        return;
+      }
+    }
+  }
+
+  void raiseMaxDistance(int distance)
+  {
+    int current = maxDistance.load();
+    while (current < distance && !maxDistance.compare_exchange_weak(current, distance))
+      ;
+  }
+
+  // One more child of index turned out to be a win at distance; once none is left undecided
+  // and no move leaves the table for a draw, index is lost
+  void childWon(uint64_t index, int distance, const vector<int> &kinds, uint64_t material)
+  {
+    uint16_t current = __atomic_load_n(&state[index], __ATOMIC_RELAXED);
+    do
+    {
+      if (current >> 14 != Unknown)
+        return;
+    } while (!__atomic_compare_exchange_n(&state[index], &current, current - 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    // Only the thread that took the count to zero gets here, and nothing else changes the
+    // position meanwhile, since all its children are wins; the slowest loss out of the table
+    // is not kept per position, so score those moves again
+    if (current - 1 != pack(Unknown, 0))
+      return;
+    Board board;
+    decode(index, kinds, board);
+    vector<uint64_t> inside;
+    int bestWin, longestLoss;
+    bool blocked;
+    scoreMoves(board, material, inside, bestWin, longestLoss, blocked);
+    int lossAt = max(distance + 1, longestLoss);
+    __atomic_store_n(&state[index], pack(Loss, lossAt), __ATOMIC_RELAXED);
+    raiseMaxDistance(lossAt);
+  }
+
+  // Positions that reach board by one quiet move of the side that just moved, as canonical indices
+  vector<uint64_t> predecessors(const Board &board)
+  {
+    vector<uint64_t> result;
+    uint8_t mover = board.turn == Piece::White ? Piece::Black : Piece::White;
+    for (int to = 0; to < 64; to++)
+    {
+      if (!(board.square[to].x & mover))
+        continue;
+      uint8_t type = board.square[to].x & 63;
+      vector<int> origins;
+      auto slide = [&](int fileStep, int rankStep)
+      {
+        int file = to % 8 + fileStep, rank = to / 8 + rankStep;
+        while (file >= 0 && file < 8 && rank >= 0 && rank < 8 && board.square[rank * 8 + file].x == Piece::None)
+        {
+          origins.push_back(rank * 8 + file);
+          if (type == Piece::King || type == Piece::Knight)
+            break;
+          file += fileStep;
+          rank += rankStep;
+        }
+      };
+      if (type == Piece::Bishop || type == Piece::Queen || type == Piece::King)
+      {
+        slide(1, 1);
+        slide(1, -1);
+        slide(-1, 1);
+        slide(-1, -1);
+      }
+      if (type == Piece::Rook || type == Piece::Queen || type == Piece::King)
+      {
+        slide(1, 0);
+        slide(-1, 0);
+        slide(0, 1);
+        slide(0, -1);
+      }
+      if (type == Piece::Knight)
+      {
+        const int jumps[8][2] = {{1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+        for (auto &jump : jumps)
+          slide(jump[0], jump[1]);
+      }
+      if (type == Piece::Pawn)
+      {
+        // White pawns move towards lower indices
+        int back = mover == Piece::White ? 8 : -8;
+        int home = mover == Piece::White ? 6 : 1;
+        int from = to + back;
+        if (from >= 8 && from < 56 && board.square[from].x == Piece::None)
+        {
+          origins.push_back(from);
+          if ((from + back) / 8 == home && board.square[from + back].x == Piece::None)
+            origins.push_back(from + back);
+        }
+      }
+      for (int from : origins)
+      {
+        Board previous = board;
+        previous.square[from] = board.square[to];
+        previous.square[to] = Piece(Piece::None);
+        previous.turn = mover;
+        if (type == Piece::Pawn)
+          previous.square[from].hasMoved = mover == Piece::White ? from / 8 != 6 : from / 8 != 1;
+        // Quiet moves are only legal when no capture is available, which is checked square by
+        // square; only rules with checks need the full move list
+        if (GameRules::forcedCaptures && previous.canCapture(mover))
+          continue;
+        if (GameRules::checks)
+        {
+          vector<string> moves = previous.findPossibleMoves(mover);
+          string move = previous.toAlgebraic(from) + previous.toAlgebraic(to);
+          if (find(moves.begin(), moves.end(), move) == moves.end())
+            continue;
+        }
+        uint64_t index = Tablebases::index(previous);
+        if (find(result.begin(), result.end(), index) == result.end())
+          result.push_back(index);
+      }
+    }
+    return result;
+  }
+
+  bool build(uint64_t material)
+  {
+    vector<int> kinds;
+    for (int kind = 0; kind < 12; kind++)
+    {
+      for (int i = 0; i < Tablebases::count(material, kind); i++)
+        kinds.push_back(kind);
+    }
+    uint64_t size = Tablebases::tableSize(kinds.size());
+    auto start = chrono::steady_clock::now();
+    state.assign(size, pack(Unknown, 0));
+    maxDistance = 0;
+
+    // Forward pass: count distinct children inside the table and score the rest
+    parallelFor(size, [&](uint64_t begin, uint64_t end)
+                {
+      Board board;
+      for (uint64_t index = begin; index < end; index++)
+      {
+        if (!decode(index, kinds, board))
+        {
+          state[index] = pack(Broken, 0);
+          continue;
+        }
+        vector<uint64_t> inside;
+        int bestWin, longestLoss;
+        bool blocked;
+        if (scoreMoves(board, material, inside, bestWin, longestLoss, blocked) == 0)
+          state[index] = pack(Win, 0);
+        else if (bestWin != None)
+        {
+          state[index] = pack(Win, bestWin);
+          raiseMaxDistance(bestWin);
+        }
+        else if (inside.size() == 0 && !blocked)
+        {
+          state[index] = pack(Loss, longestLoss);
+          raiseMaxDistance(longestLoss);
+        }
+        else
+          state[index] = pack(Unknown, inside.size()) | (blocked ? Blocked : 0);
+      } });
+
+    // Backward passes: positions decided at distance n decide their predecessors at n + 1 or later
+    for (int distance = 0; distance <= maxDistance; distance++)
+    {
+      parallelFor(size, [&](uint64_t begin, uint64_t end)
+                  {
+        Board board;
+        for (uint64_t index = begin; index < end; index++)
+        {
+          uint16_t current = __atomic_load_n(&state[index], __ATOMIC_RELAXED);
+          uint16_t result = current >> 14;
+          if ((result != Win && result != Loss) || (current & MaxState) != distance)
+            continue;
+          decode(index, kinds, board);
+          for (auto previous : predecessors(board))
+          {
+            if (result == Loss)
+              offerWin(previous, distance + 1);
+            else
+              childWon(previous, distance, kinds, material);
+          }
+        } });
+    }
+
+    // Write the compact file, then map it so larger tables can use it
+    string path = dir + "/" + Tablebases::name(material) + ".actb";
+    ofstream file(path + ".tmp", ios::binary);
+    Tablebases::Header header = {{'A', 'C', 'T', 'B'}, Tablebases::Version, material, size};
+    file.write((const char *)&header, sizeof(header));
+    vector<uint8_t> buffer;
+    uint64_t wins = 0, losses = 0, draws = 0;
+    for (uint64_t index = 0; index < size; index++)
+    {
+      uint16_t result = state[index] >> 14;
+      int distance = min((int)(state[index] & MaxState), Tablebases::MaxDistance);
+      uint8_t value = Tablebases::Draw;
+      if (result == Win)
+      {
+        value = Tablebases::WinBase + distance;
+        wins++;
+      }
+      else if (result == Loss)
+      {
+        value = Tablebases::LossBase + distance;
+        losses++;
+      }
+      else if (result == Broken)
+        value = Tablebases::Invalid;
+      else
+        draws++;
+      buffer.push_back(value);
+      if (buffer.size() == 1 << 20 || index + 1 == size)
+      {
+        file.write((const char *)buffer.data(), buffer.size());
+        buffer.clear();
+      }
+    }
+    file.close();
+    state = vector<uint16_t>();
+    if (!file || rename((path + ".tmp").c_str(), path.c_str()) != 0 || !tables.loadFile(path))
+    {
+      cerr << "Cannot write " << path << endl;
+      return false;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << Tablebases::name(material) << ": " << wins << " wins, " << losses << " losses, " << draws << " draws, longest "
+         << maxDistance << " plies, " << seconds << "s" << endl;
+    return true;
+  }
+};
+
+// Opening book file: a header then entries sorted by position key, probed in
+// place through mmap so opening it costs nothing however large it is
+class OpeningBook
+{
+public:
+  // Version 2: antichess positions carry no castling rights
+  const static uint32_t Version = 2;
+
+  struct Header
+  {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+  };
+
+  // Moves are packed as from | to << 6 | promotion << 12, promotion being a piece type bit index
+  struct Entry
+  {
+    uint64_t key;
+    uint32_t move;
+    uint32_t weight;
+  };
+
+  ~OpeningBook()
+  {
+    if (mapping)
+      munmap((void *)mapping, length);
+  }
+
+  bool loaded() const
+  {
+    return mapping != nullptr;
+  }
+
+  bool load(const string &path)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(Header))
+    {
+      close(fd);
+      return false;
+    }
+    void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+      return false;
+    const Header *header = (const Header *)data;
+    if (string(header->magic, 4) != "ACBK" || header->version != Version ||
+        sizeof(Header) + header->count * sizeof(Entry) != (uint64_t)info.st_size)
+    {
+      munmap(data, info.st_size);
+      return false;
+    }
+    mapping = (const uint8_t *)data;
+    length = info.st_size;
+    entries = (const Entry *)(mapping + sizeof(Header));
+    count = header->count;
+    return true;
+  }
+
+  // Picks a book move for board at random in proportion to its weight, "" if there is none
+  string probe(Board &board) const
+  {
+    if (!loaded())
+      return "";
+    uint64_t key = board.hashKey();
+    const Entry *first = lower_bound(entries, entries + count, key, [](const Entry &entry, uint64_t key)
+                                     { return entry.key < key; });
+    uint64_t total = 0;
+    const Entry *last = first;
+    for (; last != entries + count && last->key == key; last++)
+      total += validMove(last->move) ? last->weight : 0;
+    if (total == 0)
+      return "";
+    static thread_local mt19937_64 random(random_device{}());
+    uint64_t pick = random() % total;
+    for (const Entry *entry = first; entry != last; entry++)
+    {
+      if (!validMove(entry->move))
+        continue;
+      if (pick < entry->weight)
+        return decodeMove(board, entry->move);
+      pick -= entry->weight;
+    }
+    return "";
+  }
+
+  // Entries come straight from the file, so a corrupt or foreign one may hold a
+  // promotion field beyond the piece letters; probe skips those
+  static bool validMove(uint32_t move)
+  {
+    return (move >> 12) <= 5;
+  }
+
+  static string decodeMove(Board &board, uint32_t move)
+  {
+    if (!validMove(move))
+      return "";
+    string result = board.toAlgebraic(move & 63) + board.toAlgebraic(move >> 6 & 63);
+    if (move >> 12)
+      result += "pbnrqk"[move >> 12];
+    return result;
+  }
+
+private:
+  const uint8_t *mapping = nullptr;
+  size_t length = 0;
+  const Entry *entries = nullptr;
+  uint64_t count = 0;
+};
+
+// Shared read-only by every search thread once loaded at startup
+OpeningBook book;
+
+// Splits a PGN stream into games and calls onGame(fen, movetext, result) for every
+// antichess game, fen being empty when the game starts from the initial position
+// Returns the number of games passed on
+int readPgnGames(istream &in, function<void(const string &, const string &, const string &)> onGame)
+{
+  int games = 0;
+  string line, movetext, result, fen;
+  bool antichess = true;
+  bool inMovetext = false;
+  while (true)
+  {
+    bool more = (bool)getline(in, line);
+    if (more && line.size() && line.back() == '\r')
+      line.pop_back();
+    bool tag = more && line.size() && line[0] == '[';
+    // A tag after movetext, or the end of input, finishes the previous game
+    if ((tag && inMovetext) || !more)
+    {
+      if (antichess && (result == "1-0" || result == "0-1" || result == "1/2-1/2"))
+      {
+        onGame(fen, movetext, result);
+        games++;
+      }
+      movetext = result = fen = "";
+      antichess = true;
+      inMovetext = false;
+    }
+    if (!more)
+      break;
+    if (tag)
+    {
+      string name = line.substr(1, line.find(' ') - 1);
+      size_t open = line.find('"'), close = line.rfind('"');
+      string value = open != string::npos && close > open ? line.substr(open + 1, close - open - 1) : "";
+      if (name == "Result")
+        result = value;
+      else if (name == "FEN")
+        fen = value;
+      else if (name == "Variant")
+        antichess = value == "Antichess" || value == "antichess";
+    }
+    else if (line.find_first_not_of(" \t") != string::npos)
+    {
+      movetext += line + "\n";
+      inMovetext = true;
+    }
+  }
+  return games;
+}
+
+// Removes {comments}, ;comments and (variations) from PGN movetext
+string stripPgnComments(const string &movetext)
+{
+  string result;
+  int braces = 0, parentheses = 0;
+  bool lineComment = false;
+  for (char c : movetext)
+  {
+    if (lineComment)
+    {
+      lineComment = c != '\n';
+      if (!lineComment)
+        result += c;
+      continue;
+    }
+    if (c == '{')
+      braces++;
+    else if (c == '}' && braces)
+      braces--;
+    else if (c == '(' && !braces)
+      parentheses++;
+    else if (c == ')' && !braces && parentheses)
+      parentheses--;
+    else if (c == ';' && !braces)
+      lineComment = true;
+    else if (!braces && !parentheses)
+      result += c;
+  }
+  return result;
+}
+
+// Converts SAN movetext played from board into coordinate moves, stopping after
+// plies moves or at the first move that does not match a legal move
+vector<string> parsePgnMoves(Board board, const string &movetext, int plies)
+{
+  vector<string> played;
+  istringstream tokens(stripPgnComments(movetext));
+  string token;
+  while (played.size() < plies && tokens >> token)
+  {
+    // Skip move numbers, annotations and the result
+    size_t dot = token.find_last_of('.');
+    if (dot != string::npos)
+      token = token.substr(dot + 1);
+    while (token.size() && string("+#!?").find(token.back()) != string::npos)
+      token.pop_back();
+    if (token == "" || token[0] == '$' || token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*")
+      continue;
+    if (token == "0-0")
+      token = "O-O";
+    else if (token == "0-0-0")
+      token = "O-O-O";
+    vector<string> moves = board.findPossibleMoves(board.turn);
+    string move;
+    for (auto &candidate : moves)
+    {
+      if (board.toSan(candidate, moves) == token)
+      {
+        move = candidate;
+        break;
+      }
+    }
+    if (move == "")
+      break;
+    played.push_back(move);
+    board.makeMove(move);
+  }
+  return played;
+}
+
+// Replays PGN games and collects book entries for their first plies
+// Each move is weighted 2 per win and 1 per draw for the side that played it
+class BookBuilder
+{
+public:
+  BookBuilder(int plies) : plies(plies) {}
+
+  // Reads every game in the stream, returns the number of games used
+  int addGames(istream &in)
+  {
+    int games = 0;
+    readPgnGames(in, [&](const string &fen, const string &movetext, const string &result)
+                 {
+      Board board;
+      if (fen != "" && !board.loadFen(fen))
+        return;
+      vector<string> moves = parsePgnMoves(board, movetext, plies);
+      for (auto &move : moves)
+      {
+        uint32_t weight = result == "1/2-1/2" ? 1 : (result == "1-0") == (board.turn == Piece::White) ? 2 : 0;
+        Stats &entry = stats[{board.hashKey(), encodeMove(move)}];
+        entry.weight += weight;
+        entry.games++;
+        board.makeMove(move);
+      }
+      if (moves.size() > 0)
+        games++; });
+    return games;
+  }
+
+  // Writes the entries sorted by key, dropping moves seen in fewer than minGames games
+  bool write(const string &path, int minGames)
+  {
+    vector<OpeningBook::Entry> entries;
+    for (auto &item : stats)
+    {
+      if (item.second.games >= minGames && item.second.weight > 0)
+        entries.push_back({item.first.first, item.first.second, item.second.weight});
+    }
+    sort(entries.begin(), entries.end(), [](const OpeningBook::Entry &a, const OpeningBook::Entry &b)
+         { return a.key != b.key ? a.key < b.key : a.weight > b.weight; });
+    ofstream file(path, ios::binary);
+    OpeningBook::Header header = {{'A', 'C', 'B', 'K'}, OpeningBook::Version, entries.size()};
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)entries.data(), entries.size() * sizeof(OpeningBook::Entry));
+    cerr << "Wrote " << entries.size() << " entries to " << path << endl;
+    return (bool)file;
+  }
+
+private:
+  struct Stats
+  {
+    uint32_t weight = 0;
+    uint32_t games = 0;
+  };
+
+  struct PairHash
+  {
+    size_t operator()(const pair<uint64_t, uint32_t> &key) const
+    {
+      return key.first ^ (key.second * 0x9E3779B97F4A7C15ULL);
+    }
+  };
+
+  int plies;
+  unordered_map<pair<uint64_t, uint32_t>, Stats, PairHash> stats;
+};
+
+// Training data file: a header then fixed-size records of a position and the
+// game's result, appended as games finish and read back through mmap
+struct TrainingRecord
+{
+  // Two squares per byte, each nibble 0 for empty or Zobrist::index + 1
+  uint8_t squares[32];
+  uint8_t turn;
+  // 1 white won, 0 draw, -1 black won
+  int8_t result;
+  uint8_t castling;
+  // 64 when there is no en passant square
+  uint8_t enPassant;
+
+  static TrainingRecord fromBoard(const Board &board, int result)
+  {
+    TrainingRecord record = {};
+    for (int i = 0; i < 64; i++)
+    {
+      if (board.square[i].x != Piece::None)
+        record.squares[i / 2] |= (Zobrist::index(board.square[i].x) + 1) << (i % 2 * 4);
+    }
+    record.turn = board.turn;
+    record.result = result;
+    record.castling = board.castleableWK | board.castleableWQ << 1 | board.castleableBK << 2 | board.castleableBQ << 3;
+    record.enPassant = board.enPassantable == -1 ? 64 : board.enPassantable;
+    return record;
+  }
+
+  // Zobrist kind (0..11) on square i, or -1 if empty
+  int kind(int i) const
+  {
+    return (squares[i / 2] >> (i % 2 * 4) & 15) - 1;
+  }
+};
+
+struct TrainingHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t recordSize;
+  uint32_t reserved;
+};
+
+// Appends games to a training data file, safe to share between threads
+// Only quiet positions (no capture available) are kept, as captures are forced
+// and the static evaluation of a position mid-exchange says little
+class TrainingWriter
+{
+public:
+  const static uint32_t Version = 1;
+
+  bool open(const string &path)
+  {
+    file.open(path, ios::binary | ios::app);
+    if (!file)
+      return false;
+    if (file.tellp() == 0)
+    {
+      TrainingHeader header = {{'A', 'C', 'T', 'D'}, Version, sizeof(TrainingRecord), 0};
+      file.write((const char *)&header, sizeof(header));
+    }
+    return true;
+  }
+
+  bool isOpen()
+  {
+    return file.is_open();
+  }
+
+  // Records every quiet position of a game once its result is known, result as for TrainingRecord
+  void addGame(const vector<Board> &positions, int result)
+  {
+    lock_guard<mutex> guard(lock);
+    for (auto board : positions)
+    {
+      vector<string> moves = board.findPossibleMoves(board.turn);
+      if (moves.size() == 0 || board.isCapture(moves[0]))
+        continue;
+      buffer.push_back(TrainingRecord::fromBoard(board, result));
+      records++;
+    }
+    if (buffer.size() >= 4096)
+      flush();
+  }
+
+  uint64_t size()
+  {
+    return records;
+  }
+
+  ~TrainingWriter()
+  {
+    flush();
+  }
+
+private:
+  ofstream file;
+  mutex lock;
+  vector<TrainingRecord> buffer;
+  uint64_t records = 0;
+
+  void flush()
+  {
+    if (file.is_open() && buffer.size() > 0)
+    {
+      file.write((const char *)buffer.data(), buffer.size() * sizeof(TrainingRecord));
+      file.flush();
+    }
+    buffer.clear();
+  }
+};
+
+// Texel tuning of the piece values in EvalWeights: fits the logistic of the
+// evaluation to game results by minimising the mean squared error, first
+// the scaling constant K and then each weight by integer local search
+// Records are streamed from the mmap'd file on every pass, so memory use does
+// not depend on the size of the data
+class TexelTuner
+{
+public:
+  TexelTuner(int threads) : threads(threads) {}
+
+  ~TexelTuner()
+  {
+    if (mapping)
+      munmap((void *)mapping, length);
+  }
+
+  bool load(const string &path)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(TrainingHeader))
+    {
+      close(fd);
+      return false;
+    }
+    void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+      return false;
+    mapping = (const uint8_t *)data;
+    length = info.st_size;
+    const TrainingHeader *header = (const TrainingHeader *)mapping;
+    if (string(header->magic, 4) != "ACTD" || header->version != TrainingWriter::Version || header->recordSize != sizeof(TrainingRecord))
+      return false;
+    madvise(data, length, MADV_SEQUENTIAL);
+    records = (const TrainingRecord *)(mapping + sizeof(TrainingHeader));
+    count = (length - sizeof(TrainingHeader)) / sizeof(TrainingRecord);
+    return true;
+  }
+
+  uint64_t size()
+  {
+    return count;
+  }
+
+  EvalWeights tune(EvalWeights weights, int maxPasses)
+  {
+    int values[6] = {weights.pawn, weights.bishop, weights.knight, weights.rook, weights.queen, weights.king};
+    const char *names[6] = {"pawn", "bishop", "knight", "rook", "queen", "king"};
+    k = fitK(values);
+    double best = error(values, k);
+    cerr << "K " << k << ", error " << best << endl;
+    // Each weight's step doubles while moving it keeps helping and halves when it does not,
+    // finishing after a pass that changes nothing with every step down to 1
+    int steps[6];
+    for (int i = 0; i < 6; i++)
+      steps[i] = max(1, abs(values[i]) / 4);
+    for (int pass = 0; pass < maxPasses; pass++)
+    {
+      bool improved = false;
+      for (int i = 0; i < 6; i++)
+      {
+        bool moved = false;
+        for (int direction : {1, -1})
+        {
+          values[i] += direction * steps[i];
+          double candidate = error(values, k);
+          if (candidate < best)
+          {
+            best = candidate;
+            moved = true;
+            break;
+          }
+          values[i] -= direction * steps[i];
+        }
+        improved |= moved || steps[i] > 1;
+        steps[i] = moved ? min(steps[i] * 2, 1 << 16) : max(steps[i] / 2, 1);
+      }
+      cerr << "Pass " << pass + 1 << ", error " << best << ":";
+      for (int i = 0; i < 6; i++)
+        cerr << " " << names[i] << " " << values[i];
+      cerr << endl;
+      if (!improved)
+        break;
+    }
+    weights.pawn = values[0];
+    weights.bishop = values[1];
+    weights.knight = values[2];
+    weights.rook = values[3];
+    weights.queen = values[4];
+    weights.king = values[5];
+    return weights;
+  }
+
+  static bool save(const EvalWeights &weights, const string &path)
+  {
+    ofstream file(path);
+    file << "pawn " << weights.pawn << "\n";
+    file << "bishop " << weights.bishop << "\n";
+    file << "knight " << weights.knight << "\n";
+    file << "rook " << weights.rook << "\n";
+    file << "queen " << weights.queen << "\n";
+    file << "king " << weights.king << "\n";
+    return (bool)file;
+  }
+
+private:
+  int threads;
+  const uint8_t *mapping = nullptr;
+  size_t length = 0;
+  const TrainingRecord *records = nullptr;
+  uint64_t count = 0;
+  double k = 1;
+
+  // Mean squared error of the predicted score against the results, over every record on every thread
+  double error(const int values[6], double k)
+  {
+    vector<double> sums(threads, 0);
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++)
+    {
+      workers.emplace_back([&, t]
+                           {
+        uint64_t begin = count * t / threads, end = count * (t + 1) / threads;
+        double sum = 0;
+        for (uint64_t i = begin; i < end; i++)
+        {
+          const TrainingRecord &record = records[i];
+          int score = 0;
+          for (int sq = 0; sq < 64; sq++)
+          {
+            int kind = record.kind(sq);
+            if (kind >= 0)
+              score += kind & 1 ? -values[kind / 2] : values[kind / 2];
+          }
+          double predicted = 1 / (1 + exp(-k * score));
+          double actual = (record.result + 1) / 2.0;
+          sum += (actual - predicted) * (actual - predicted);
+        }
+        sums[t] = sum; });
+    }
+    for (auto &worker : workers)
+      worker.join();
+    double total = 0;
+    for (auto sum : sums)
+      total += sum;
+    return count ? total / count : 0;
+  }
+
+  // Golden-section search for the K that best fits the starting weights
+  double fitK(const int values[6])
+  {
+    double low = 0.001, high = 10;
+    const double ratio = (sqrt(5) - 1) / 2;
+    double a = high - ratio * (high - low), b = low + ratio * (high - low);
+    double errorA = error(values, a), errorB = error(values, b);
+    for (int i = 0; i < 30; i++)
+    {
+      if (errorA < errorB)
+      {
+        high = b;
+        b = a;
+        errorB = errorA;
+        a = high - ratio * (high - low);
+        errorA = error(values, a);
+      }
+      else
+      {
+        low = a;
+        a = b;
+        errorA = errorB;
+        b = low + ratio * (high - low);
+        errorB = error(values, b);
+      }
+    }
+    return (low + high) / 2;
+  }
+};
+
+// Adds board, the position just reached, to a game's history of position keys
+// Positions before an irreversible move can never repeat, so they are dropped
+void recordPosition(vector<uint64_t> &history, Board &board)
+{
+  if (board.halfmove == 0)
+    history.clear();
+  history.push_back(board.hashKey());
+}
+
+// Returns a move that needs no search, or "" if there is none
+// Book moves are free, then play a proven win instantly, the small budget keeps failed attempts cheap
+string instantMove(Board &board, uint8_t colour, const vector<string> &moves)
+{
+  string bestMove = book.probe(board);
+  if (find(moves.begin(), moves.end(), bestMove) == moves.end())
+    bestMove = "";
+  // One small solver per thread, reused for every move rather than allocated each time
+  thread_local ProofNumberSolver solver(1, 5000);
+  if (bestMove == "" && solver.solve(board, colour) == ProofNumberSolver::Proven)
+  {
+    vector<string> line = solver.winningLine(board);
+    if (line.size() > 0)
+      bestMove = line[0];
+  }
+  return bestMove;
+}
+
+void aiMove(Board &board, uint8_t ai, int depth, vector<uint64_t> &history)
+{
+  vector<string> moves = board.findPossibleMoves(ai);
+  int kingPos = board.kingFind(ai);
+  if (moves.size() == 0)
+    return;
+  string bestMove = instantMove(board, ai, moves);
+  SearchContext ctx;
+  ctx.setHistory(history);
+  if (bestMove == "")
+    bestMove = board.bestMove(ai, depth, &ctx);
+  if (bestMove == "")
+    bestMove = moves[0];
+  cout << bestMove << endl;
+  board.makeMove(bestMove);
+  recordPosition(history, board);
+}
+void playerMove(Board &board, vector<uint64_t> &history)
+{
+  string move;
+  cin >> move;
+  board.makeMove(move);
+  recordPosition(history, board);
+}
+void moveIterator(int argc, char *argv[])
+{
+  Board board;
+  string move;
+  string aiColorStr = argv[1];
+  uint8_t ai = aiColorStr == "white" ? Piece::White : Piece::Black;
+  int moveCounter = 0;
+  int depth = 5;
+  vector<uint64_t> history = {board.hashKey()};
+
+  if (ai == Piece::White) // ai is white, player is black
+  {
+    aiMove(board, ai, depth, history);
+    moveCounter++;
+    if (moveCounter >= 7)
+    {
+      moveCounter = 0;
+      depth++;
+      if (depth == 9)
+        depth = 8;
+    }
+  }
+  while (true)
+  {
+    playerMove(board, history);
+    moveCounter++;
+    if (moveCounter >= 7)
+    {
+      moveCounter = 0;
+      depth++;
+      if (depth == 9)
+        depth = 8;
+    }
+    aiMove(board, ai, depth, history);
+    moveCounter++;
+    if (moveCounter >= 7)
+    {
+      moveCounter = 0;
+      depth++;
+      if (depth == 9)
+        depth = 8;
+    }
+  }
+}
+int defaultThreads()
+{
+  int threads = thread::hardware_concurrency();
+  return threads > 0 ? threads : 1;
+}
+
+// Returns moves separated by spaces
+string joinMoves(const vector<string> &moves)
+{
+  string result;
+  for (auto &move : moves)
+    result += (result == "" ? "" : " ") + move;
+  return result;
+}
+
+// Analyses one FEN/EPD per line on a pool of worker threads
+// Results are written in input order, and only a bounded window of lines
+// is in flight at once so memory stays flat regardless of input size
+class BatchRunner
+{
+public:
+  BatchRunner(istream &in, ostream &out, int threads, int depth, int movetime, bool json, int multipv = 1, bool exchanges = false)
+      : in(in), out(out), threads(threads), depth(depth), movetime(movetime), json(json), multipv(multipv), exchanges(exchanges), window(threads * 16) {}
+
+  void run()
+  {
+    string extra = exchanges ? ",exchange" : "";
+    if (!json && multipv == 1)
+      out << "id,fen,bestmove,score,depth,nodes" << extra << endl;
+    else if (!json)
+      out << "id,fen,multipv,move,score,depth,nodes,pv" << extra << endl;
+    vector<thread> workers;
+    for (int i = 0; i < threads; i++)
+      workers.emplace_back(&BatchRunner::worker, this);
+    for (auto &worker : workers)
+      worker.join();
+    out.flush();
+  }
+
+private:
+  istream &in;
+  ostream &out;
+  int threads;
+  int depth;
+  int movetime;
+  bool json;
+  int multipv;
+  bool exchanges;
+  uint64_t window;
+  mutex lock;
+  condition_variable ready;
+  bool finished = false;
+  uint64_t nextRead = 0;
+  uint64_t nextWrite = 0;
+  map<uint64_t, string> pending;
+
+  void worker()
+  {
+    SearchContext ctx;
+    while (true)
+    {
+      string line;
+      uint64_t id;
+      {
+        unique_lock<mutex> guard(lock);
+        ready.wait(guard, [this]
+                   { return finished || nextRead - nextWrite < window; });
+        if (finished)
+          return;
+        if (!getline(in, line))
+        {
+          finished = true;
+          ready.notify_all();
+          return;
+        }
+        id = nextRead++;
+      }
+      string output = analyse(line, id, ctx);
+      {
+        lock_guard<mutex> guard(lock);
+        pending[id] = output;
+        while (pending.count(nextWrite))
+        {
+          out << pending[nextWrite];
+          pending.erase(nextWrite);
+          nextWrite++;
+        }
+        ready.notify_all();
+      }
+    }
+  }
+
+  // Returns the formatted output for one input line, empty for blank lines and comments
+  string analyse(const string &line, uint64_t id, SearchContext &ctx)
+  {
+    if (line.find_first_not_of(" \t\r") == string::npos || line[0] == '#')
+      return "";
+    Board board;
+    ostringstream row;
+    istringstream fields(line);
+    string placement, side, castling, enPassant;
+    fields >> placement >> side >> castling >> enPassant;
+    string fen = placement + " " + side + " " + castling + " " + enPassant;
+    if (!board.loadFen(line))
+    {
+      if (json)
+        row << "{\"id\":" << id << ",\"error\":\"invalid position\"}" << endl;
+      else if (multipv == 1)
+        row << id << ",,error,,," << (exchanges ? "," : "") << endl;
+      else
+        row << id << ",,1,error,,,," << (exchanges ? "," : "") << endl;
+      return row.str();
+    }
+    ctx.reset(movetime);
+    if (multipv > 1)
+    {
+      vector<SearchResult> lines = board.searchMultiPV(board.turn, depth, multipv, ctx);
+      if (json)
+      {
+        row << "{\"id\":" << id << ",\"fen\":\"" << fen << "\",\"lines\":[";
+        for (int i = 0; i < lines.size(); i++)
+        {
+          row << (i ? "," : "") << "{\"move\":\"" << lines[i].move << "\",\"score\":" << lines[i].score
+              << ",\"depth\":" << lines[i].depth << ",\"pv\":\"" << joinMoves(lines[i].pv) << "\"";
+          if (exchanges)
+            row << ",\"exchange\":" << board.moveExchange(lines[i].move);
+          row << "}";
+        }
+        row << "],\"nodes\":" << ctx.nodes << "}" << endl;
+      }
+      else
+      {
+        for (int i = 0; i < lines.size(); i++)
+        {
+          row << id << "," << fen << "," << i + 1 << "," << lines[i].move << "," << lines[i].score << ","
+              << lines[i].depth << "," << lines[i].nodes << "," << joinMoves(lines[i].pv);
+          if (exchanges)
+            row << "," << board.moveExchange(lines[i].move);
+          row << endl;
+        }
+        if (lines.size() == 0)
+          row << id << "," << fen << ",1,none,,,," << (exchanges ? "," : "") << endl;
+      }
+      return row.str();
+    }
+    SearchResult result = board.search(board.turn, depth, ctx);
+    string move = result.move == "" ? "none" : result.move;
+    // Static exchange of the chosen move, empty or null when there is none
+    string exchange = result.move == "" ? "" : to_string(board.moveExchange(result.move));
+    if (json)
+    {
+      row << "{\"id\":" << id << ",\"fen\":\"" << fen << "\",\"bestmove\":\"" << move
+          << "\",\"score\":" << result.score << ",\"depth\":" << result.depth << ",\"nodes\":" << result.nodes;
+      if (exchanges)
+        row << ",\"exchange\":" << (exchange == "" ? "null" : exchange);
+      row << "}" << endl;
+    }
+    else
+    {
+      row << id << "," << fen << "," << move << "," << result.score << "," << result.depth << "," << result.nodes;
+      if (exchanges)
+        row << "," << exchange;
+      row << endl;
+    }
+    return row.str();
+  }
+};
+
+// Usage: ./a.out analyse [--fen "<fen>"] [--depth plies] [--movetime ms] [--multipv n]
+//        [--save-hash file] [--save-interval seconds] [--exchanges 1]
+// Prints the ranked lines after every completed depth, starting from the initial position without --fen;
+// --exchanges first lists every legal move with its static exchange, best for the side to move first
+// The search runs on this thread alone; only batch mode spreads work, one position per thread
+void runAnalyse(int argc, char *argv[])
+{
+  Board board;
+  string fen = getOption(argc, argv, "--fen", "");
+  if (fen != "" && !board.loadFen(fen))
+  {
+    cerr << "Invalid position " << fen << endl;
+    return;
+  }
+  int depth = stoi(getOption(argc, argv, "--depth", "64"));
+  int movetime = stoi(getOption(argc, argv, "--movetime", depth == 64 ? "5000" : "0"));
+  int multipv = stoi(getOption(argc, argv, "--multipv", "1"));
+  string savePath = getOption(argc, argv, "--save-hash", "");
+  int saveInterval = stoi(getOption(argc, argv, "--save-interval", "60"));
+  if (stoi(getOption(argc, argv, "--exchanges", "0")) != 0)
+  {
+    vector<pair<int, string>> scored;
+    for (auto &move : board.findPossibleMoves(board.turn))
+      scored.push_back({board.moveExchange(move), move});
+    int sign = board.turn == Piece::White ? 1 : -1;
+    stable_sort(scored.begin(), scored.end(), [&](const pair<int, string> &a, const pair<int, string> &b)
+                { return a.first * sign > b.first * sign; });
+    for (auto &entry : scored)
+      cout << "exchange " << entry.second << " " << entry.first << endl;
+  }
+  SearchContext ctx;
+  ctx.reset(movetime);
+  auto start = chrono::steady_clock::now();
+  auto lastSave = start;
+  vector<SearchResult> lines = board.searchMultiPV(board.turn, depth, max(multipv, 1), ctx, [&](const vector<SearchResult> &lines)
+                                                   {
+    auto now = chrono::steady_clock::now();
+    int elapsed = chrono::duration_cast<chrono::milliseconds>(now - start).count();
+    for (int i = 0; i < lines.size(); i++)
+      cout << "depth " << lines[i].depth << " multipv " << i + 1 << " score " << lines[i].score << " nodes " << lines[i].nodes
+           << " nps " << lines[i].nodes * 1000 / max(elapsed, 1) << " time " << elapsed << " pv " << joinMoves(lines[i].pv) << endl;
+    // Checkpoint long analyses so a restart loses at most one interval of work
+    if (savePath != "" && now - lastSave >= chrono::seconds(saveInterval))
+    {
+      transpositions.save(savePath);
+      lastSave = now;
+    } });
+  if (lines.size() > 0)
+    cout << "bestmove " << lines[0].move << endl;
+  if (savePath != "" && !transpositions.save(savePath))
+    cerr << "Cannot save hash to " << savePath << endl;
+}
+
+// Per-side engine settings for self-play
+struct EngineSettings
+{
+  string name;
+  int depth = 6;
+  int movetime = 0;
+  EvalWeights weights;
+  SearchOptions options;
+  shared_ptr<TranspositionTable> table;
+};
+
+// A starting point for self-play games, either a FEN or moves from the initial position
+struct Opening
+{
+  string fen;
+  vector<string> moves;
+};
+
+// Plays engine-vs-engine games concurrently, each opening twice with colours swapped
+// Games are decided by antichess rules: the side to move wins when it has no legal
+// moves (which includes having lost every piece), and repetition or the 50-move rule draws
+class SelfPlayRunner
+{
+public:
+  SelfPlayRunner(const vector<Opening> &openings, const EngineSettings &first, const EngineSettings &second, int games, int threads, ostream &out, TrainingWriter *data = nullptr)
+      : openings(openings), first(first), second(second), games(games), threads(threads), out(out), data(data) {}
+
+  void run()
+  {
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int i = 0; i < threads; i++)
+      workers.emplace_back(&SelfPlayRunner::worker, this);
+    for (auto &worker : workers)
+      worker.join();
+    out.flush();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printStats(seconds);
+  }
+
+private:
+  const vector<Opening> &openings;
+  const EngineSettings &first;
+  const EngineSettings &second;
+  int games;
+  int threads;
+  ostream &out;
+  TrainingWriter *data;
+  atomic<int> nextGame{0};
+  mutex lock;
+  int nextWrite = 0;
+  map<int, string> pending;
+  int wins = 0;
+  int draws = 0;
+  int losses = 0;
+
+  void worker()
+  {
+    SearchContext ctx;
+    int game;
+    while ((game = nextGame++) < games)
+    {
+      int outcome;
+      string pgn = play(game, ctx, outcome);
+      lock_guard<mutex> guard(lock);
+      if (outcome > 0)
+        wins++;
+      else if (outcome < 0)
+        losses++;
+      else
+        draws++;
+      pending[game] = pgn;
+      while (pending.count(nextWrite))
+      {
+        out << pending[nextWrite];
+        pending.erase(nextWrite);
+        nextWrite++;
+      }
+    }
+  }
+
+  // Plays one game and returns its PGN, outcome is from the first engine's point of view
+  string play(int game, SearchContext &ctx, int &outcome)
+  {
+    const Opening &opening = openings[(game / 2) % openings.size()];
+    bool firstIsWhite = game % 2 == 0;
+    const EngineSettings &white = firstIsWhite ? first : second;
+    const EngineSettings &black = firstIsWhite ? second : first;
+    Board board;
+    if (opening.fen != "")
+      board.loadFen(opening.fen);
+    string startFen = board.toFen();
+    string movetext;
+    int fullmove = 1;
+    vector<uint64_t> keys = {board.hashKey()};
+    vector<Board> positions;
+    string result, termination;
+    size_t openingIndex = 0;
+    while (true)
+    {
+      uint8_t colour = board.turn;
+      vector<string> moves = board.findPossibleMoves(colour);
+      if (moves.size() == 0)
+      {
+        result = colour == Piece::White ? "1-0" : "0-1";
+        termination = "no legal moves";
+        break;
+      }
+      if (data && openingIndex >= opening.moves.size())
+        positions.push_back(board);
+      string move;
+      if (openingIndex < opening.moves.size())
+        move = opening.moves[openingIndex++];
+      else
+      {
+        const EngineSettings &side = colour == Piece::White ? white : black;
+        ctx.reset(side.movetime);
+        ctx.weights = &side.weights;
+        ctx.options = side.options;
+        ctx.table = side.table.get();
+        ctx.setHistory(keys);
+        move = board.search(colour, side.depth, ctx).move;
+      }
+      if (colour == Piece::White || movetext == "")
+        movetext += to_string(fullmove) + (colour == Piece::White ? ". " : "... ");
+      movetext += board.toSan(move, moves) + " ";
+      board.makeMove(move);
+      if (colour == Piece::Black)
+        fullmove++;
+      recordPosition(keys, board);
+      if (board.halfmove >= 100)
+      {
+        result = "1/2-1/2";
+        termination = "50-move rule";
+        break;
+      }
+      int repetitions = 0;
+      for (auto key : keys)
+        repetitions += key == keys.back();
+      if (repetitions >= 3)
+      {
+        result = "1/2-1/2";
+        termination = "threefold repetition";
+        break;
+      }
+    }
+    if (result == "1/2-1/2")
+      outcome = 0;
+    else
+      outcome = (result == "1-0") == firstIsWhite ? 1 : -1;
+    if (data)
+      data->addGame(positions, result == "1-0" ? 1 : result == "0-1" ? -1 : 0);
+
+    ostringstream pgn;
+    pgn << "[Event \"Self-play\"]\n";
+    pgn << "[Round \"" << game + 1 << "\"]\n";
+    pgn << "[White \"" << white.name << "\"]\n";
+    pgn << "[Black \"" << black.name << "\"]\n";
+    pgn << "[Result \"" << result << "\"]\n";
+    pgn << "[Variant \"Antichess\"]\n";
+    if (opening.fen != "")
+    {
+      pgn << "[SetUp \"1\"]\n";
+      pgn << "[FEN \"" << startFen << "\"]\n";
+    }
+    pgn << "[Termination \"" << termination << "\"]\n\n";
+    pgn << movetext << result << "\n\n";
+    return pgn.str();
+  }
+
+  // Prints W/D/L for the first engine with a 95% confidence Elo interval
+  void printStats(double seconds)
+  {
+    int n = wins + draws + losses;
+    if (n == 0)
+      return;
+    double score = (wins + draws * 0.5) / n;
+    double variance = (wins * pow(1 - score, 2) + draws * pow(0.5 - score, 2) + losses * pow(score, 2)) / n;
+    double error = 1.96 * sqrt(variance / n);
+    auto elo = [](double p)
+    {
+      p = min(max(p, 1e-6), 1 - 1e-6);
+      return -400 * log10(1 / p - 1);
+    };
+    cerr << fixed << setprecision(1);
+    cerr << first.name << " vs " << second.name << ": " << n << " games, W/D/L " << wins << "/" << draws << "/" << losses << endl;
+    cerr << "Score " << score * 100 << "% +/- " << error * 100 << "%, Elo " << elo(score) << " +/- " << (elo(score + error) - elo(score - error)) / 2 << endl;
+    cerr << "Time " << seconds << "s, " << n / seconds << " games/s" << endl;
+  }
+};
+
+// Reads openings, one per line, as either a FEN or coordinate moves from the initial position
+vector<Opening> loadOpenings(const string &path)
+{
+  vector<Opening> openings;
+  ifstream file(path);
+  string line;
+  while (getline(file, line))
+  {
+    if (line.find_first_not_of(" \t\r") == string::npos || line[0] == '#')
+      continue;
+    Opening opening;
+    Board board;
+    if (line.find('/') != string::npos)
+    {
+      if (!board.loadFen(line))
+      {
+        cerr << "Skipping invalid opening: " << line << endl;
+        continue;
+      }
+      opening.fen = line;
+    }
+    else
+    {
+      istringstream moves(line);
+      string move;
+      bool valid = true;
+      while (moves >> move)
+      {
+        vector<string> legal = board.findPossibleMoves(board.turn);
+        if (find(legal.begin(), legal.end(), move) == legal.end())
+        {
+          valid = false;
+          break;
+        }
+        board.makeMove(move);
+        opening.moves.push_back(move);
+      }
+      if (!valid)
+      {
+        cerr << "Skipping invalid opening: " << line << endl;
+        continue;
+      }
+    }
+    openings.push_back(opening);
+  }
+  return openings;
+}
+
+// Reads --depthN, --movetimeN, --evalN and the selective search flags for side N (1 or 2)
+// --evalN is "material" for the built-in piece values or a weights file
+bool loadEngineSettings(int argc, char *argv[], const string &side, EngineSettings &settings)
+{
+  settings.movetime = stoi(getOption(argc, argv, "--movetime" + side, getOption(argc, argv, "--movetime", "0")));
+  // With a movetime the clock limits the search, unless a depth is given as well
+  string depth = settings.movetime > 0 ? "64" : "6";
+  settings.depth = stoi(getOption(argc, argv, "--depth" + side, getOption(argc, argv, "--depth", depth)));
+  settings.options = searchOptions;
+  settings.options.parse(argc, argv, side);
+  settings.table = make_shared<TranspositionTable>();
+  settings.table->numa = transpositions.numa;
+  settings.table->resize(stoull(getOption(argc, argv, "--hash", "64")));
+  string eval = getOption(argc, argv, "--eval" + side, "material");
+  string limit = "depth " + to_string(settings.depth);
+  if (settings.movetime > 0)
+    limit = settings.depth < 64 ? limit + ", " + to_string(settings.movetime) + " ms" : to_string(settings.movetime) + " ms";
+  settings.name = "engine" + side + " (" + limit + ", " + eval + ")";
+  if (eval != "material" && !settings.weights.load(eval))
+  {
+    cerr << "Cannot open " << eval << endl;
+    return false;
+  }
+  return true;
+}
+
+// Usage: ./a.out selfplay [--openings file] [--games n] [--threads n] [--pgn file]
+//        [--depth1 plies] [--movetime1 ms] [--eval1 material|file] (and the same for side 2)
+//        [--data file] to append the games' quiet positions as training data
+void runSelfPlay(int argc, char *argv[])
+{
+  vector<Opening> openings;
+  string openingsPath = getOption(argc, argv, "--openings", "");
+  if (openingsPath != "")
+    openings = loadOpenings(openingsPath);
+  if (openings.size() == 0)
+    openings.push_back(Opening());
+  EngineSettings first, second;
+  if (!loadEngineSettings(argc, argv, "1", first) || !loadEngineSettings(argc, argv, "2", second))
+    return;
+  int games = stoi(getOption(argc, argv, "--games", to_string(openings.size() * 2)));
+  int threads = stoi(getOption(argc, argv, "--threads", to_string(defaultThreads())));
+  string pgnPath = getOption(argc, argv, "--pgn", "-");
+  ofstream file;
+  if (pgnPath != "-")
+  {
+    file.open(pgnPath);
+    if (!file)
+    {
+      cerr << "Cannot open " << pgnPath << endl;
+      return;
+    }
+  }
+  TrainingWriter data;
+  string dataPath = getOption(argc, argv, "--data", "");
+  if (dataPath != "" && !data.open(dataPath))
+  {
+    cerr << "Cannot open " << dataPath << endl;
+    return;
+  }
+  SelfPlayRunner runner(openings, first, second, games, max(threads, 1), pgnPath == "-" ? cout : file, data.isOpen() ? &data : nullptr);
+  runner.run();
+  if (data.isOpen())
+    cerr << "Wrote " << data.size() << " training positions to " << dataPath << endl;
+}
+
+// Usage: ./a.out batch [--input file] [--threads n] [--depth plies] [--movetime ms] [--format csv|json] [--multipv n]
+//        [--exchanges 1] to add the static exchange of each reported move
+void runBatch(int argc, char *argv[])
+{
+  string input = getOption(argc, argv, "--input", "-");
+  int threads = stoi(getOption(argc, argv, "--threads", to_string(defaultThreads())));
+  int depth = stoi(getOption(argc, argv, "--depth", "6"));
+  int movetime = stoi(getOption(argc, argv, "--movetime", "0"));
+  bool json = getOption(argc, argv, "--format", "csv") == "json";
+  int multipv = stoi(getOption(argc, argv, "--multipv", "1"));
+  bool exchanges = stoi(getOption(argc, argv, "--exchanges", "0")) != 0;
+  ifstream file;
+  if (input != "-")
+  {
+    file.open(input);
+    if (!file)
+    {
+      cerr << "Cannot open " << input << endl;
+      return;
+    }
+  }
+  BatchRunner runner(input == "-" ? cin : file, cout, max(threads, 1), max(depth, 1), movetime, json, max(multipv, 1), exchanges);
+  runner.run();
+}
+
+// Usage: ./a.out solve [--fen "<fen>"] [--nodes n] [--hash MB]
+// Without --fen, positions are read from stdin one per line
+// Reports win/loss for the side to move, draw when neither side can force a
+// win, or unknown when the node budget runs out
+void runSolve(int argc, char *argv[])
+{
+  string fen = getOption(argc, argv, "--fen", "");
+  uint64_t maxNodes = stoull(getOption(argc, argv, "--nodes", "10000000"));
+  size_t hashMB = stoull(getOption(argc, argv, "--hash", "256"));
+  ProofNumberSolver solver(hashMB, maxNodes);
+  string line;
+  while (fen != "" || getline(cin, line))
+  {
+    if (fen != "")
+      line = fen;
+    if (line.find_first_not_of(" \t\r") != string::npos && line[0] != '#')
+    {
+      Board board;
+      if (!board.loadFen(line))
+        cout << "invalid position" << endl;
+      else
+      {
+        uint8_t opposite = board.turn == Piece::White ? Piece::Black : Piece::White;
+        auto start = chrono::steady_clock::now();
+        string result = "unknown";
+        uint64_t nodes = 0;
+        vector<string> winningLine;
+        ProofNumberSolver::Result forSide = solver.solve(board, board.turn);
+        nodes += solver.nodes;
+        if (forSide == ProofNumberSolver::Proven)
+        {
+          result = "win";
+          winningLine = solver.winningLine(board);
+        }
+        else
+        {
+          ProofNumberSolver::Result forOpponent = solver.solve(board, opposite);
+          nodes += solver.nodes;
+          if (forOpponent == ProofNumberSolver::Proven)
+          {
+            result = "loss";
+            winningLine = solver.winningLine(board);
+          }
+          else if (forSide == ProofNumberSolver::Disproven && forOpponent == ProofNumberSolver::Disproven)
+            result = "draw";
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "result " << result << " nodes " << nodes << " time " << seconds << "s";
+        if (winningLine.size() > 0)
+        {
+          cout << " line";
+          for (auto &move : winningLine)
+            cout << " " << move;
+        }
+        cout << endl;
+      }
+    }
+    if (fen != "")
+      break;
+  }
+}
+
+// Usage: ./a.out tbgen [--pieces n | --material KRvK] [--dir path] [--threads n]
+// Tables already present in the directory are reused
+void runTablebaseGen(int argc, char *argv[])
+{
+  string dir = getOption(argc, argv, "--dir", "tablebases");
+  int pieces = stoi(getOption(argc, argv, "--pieces", "3"));
+  string name = getOption(argc, argv, "--material", "");
+  int threads = stoi(getOption(argc, argv, "--threads", to_string(defaultThreads())));
+  mkdir(dir.c_str(), 0755);
+  tablebases.load(dir);
+  TablebaseGenerator generator(tablebases, dir, max(threads, 1));
+  vector<uint64_t> materials;
+  if (name != "")
+  {
+    uint64_t material = Tablebases::parseName(name);
+    if (material == 0 || Tablebases::pieceCount(material) > 6)
+    {
+      cerr << "Invalid material " << name << endl;
+      return;
+    }
+    materials.push_back(material);
+  }
+  else
+    materials = TablebaseGenerator::allMaterials(min(pieces, 6));
+  for (auto material : materials)
+  {
+    if (!generator.generate(material))
+      return;
+  }
+}
+
+// Usage: ./a.out tbprobe --tb dir [--fen "<fen>"]
+// Without --fen, positions are read from stdin one per line
+// Prints the stored result for the side to move: win or loss with its distance in plies,
+// draw, or none when no loaded table covers the position
+void runTablebaseProbe(int argc, char *argv[])
+{
+  string fen = getOption(argc, argv, "--fen", "");
+  string line;
+  while (fen != "" || getline(cin, line))
+  {
+    if (fen != "")
+      line = fen;
+    if (line.find_first_not_of(" \t\r") != string::npos && line[0] != '#')
+    {
+      Board board;
+      uint8_t value;
+      if (!board.loadFen(line))
+        cout << "invalid position" << endl;
+      else if (!tablebases.probe(board, value))
+        cout << "none" << endl;
+      else if (value == Tablebases::Draw)
+        cout << "draw" << endl;
+      else if (value < Tablebases::LossBase)
+        cout << "win " << value - Tablebases::WinBase << endl;
+      else
+        cout << "loss " << value - Tablebases::LossBase << endl;
+    }
+    if (fen != "")
+      break;
+  }
+}
+
+// Usage: ./a.out book --out book.bin [--pgn games.pgn] [--plies n] [--min-games n]
+// PGN is read from stdin if --pgn is omitted, only antichess games are used
+void runBookBuilder(int argc, char *argv[])
+{
+  string pgnPath = getOption(argc, argv, "--pgn", "-");
+  string out = getOption(argc, argv, "--out", "book.bin");
+  int plies = stoi(getOption(argc, argv, "--plies", "20"));
+  int minGames = stoi(getOption(argc, argv, "--min-games", "1"));
+  ifstream file;
+  if (pgnPath != "-")
+  {
+    file.open(pgnPath);
+    if (!file)
+    {
+      cerr << "Cannot open " << pgnPath << endl;
+      return;
+    }
+  }
+  BookBuilder builder(plies);
+  int games = builder.addGames(pgnPath == "-" ? cin : file);
+  cerr << "Read " << games << " games" << endl;
+  builder.write(out, minGames);
+}
+
+// Plays many games at once over a line protocol on stdin/stdout, so one
+// process (and one copy of the book and tablebases) serves every game
+//   new <id> white|black [time ms] [inc ms] [depth n] [fen <fen>]  start a game, the engine plays the given colour
+//   move <id> <move>                                               the opponent's move
+//   end <id>                                                       forget a game
+// Replies are "bestmove <id> <move>" ("(none)" when the engine has no moves) and "error <id> <reason>"
+// Searches run on a shared pool of threads, so a game only costs its board and clock
+// Each game has at most one search queued, served first come first served, so no game can starve the others
+class GameServer
+{
+public:
+  GameServer(istream &in, ostream &out, int threads, int depth) : in(in), out(out), threads(threads), depth(depth) {}
+
+  void run()
+  {
+    vector<thread> workers;
+    for (int i = 0; i < threads; i++)
+      workers.emplace_back(&GameServer::worker, this);
+    string line;
+    while (getline(in, line))
+      handle(line);
+    {
+      lock_guard<mutex> guard(lock);
+      finished = true;
+    }
+    ready.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+    out.flush();
+  }
+
+private:
+  struct Session
+  {
+    string id;
+    Board board;
+    uint8_t ai;
+    int depth;
+    // Clock in milliseconds, 0 when the game is untimed
+    int remaining = 0;
+    int increment = 0;
+    vector<uint64_t> history;
+    // When the pending search was queued, the engine's clock runs from then
+    chrono::steady_clock::time_point queued;
+    bool searching = false;
+    bool ended = false;
+  };
+
+  istream &in;
+  ostream &out;
+  int threads;
+  int depth;
+  mutex lock;
+  condition_variable ready;
+  bool finished = false;
+  map<string, shared_ptr<Session>> sessions;
+  deque<shared_ptr<Session>> queue;
+
+  void reply(const string &line)
+  {
+    out << line << endl;
+  }
+
+  // Queues a search if it is the engine's turn, lock must be held
+  void schedule(const shared_ptr<Session> &session)
+  {
+    if (session->board.turn != session->ai || session->searching)
+      return;
+    session->searching = true;
+    session->queued = chrono::steady_clock::now();
+    queue.push_back(session);
+    ready.notify_one();
+  }
+
+  void handle(const string &line)
+  {
+    istringstream tokens(line);
+    string command, id;
+    if (!(tokens >> command))
+      return;
+    tokens >> id;
+    lock_guard<mutex> guard(lock);
+    if (command == "new")
+    {
+      auto session = make_shared<Session>();
+      session->id = id;
+      session->depth = depth;
+      string colour, name;
+      tokens >> colour;
+      if (colour != "white" && colour != "black")
+      {
+        reply("error " + id + " expected white or black");
+        return;
+      }
+      session->ai = colour == "white" ? Piece::White : Piece::Black;
+      while (tokens >> name)
+      {
+        if (name == "fen")
+        {
+          string fen;
+          getline(tokens, fen);
+          if (!session->board.loadFen(fen))
+          {
+            reply("error " + id + " invalid fen");
+            return;
+          }
+        }
+        else if (name == "time")
+          tokens >> session->remaining;
+        else if (name == "inc")
+          tokens >> session->increment;
+        else if (name == "depth")
+          tokens >> session->depth;
+      }
+      session->history = {session->board.hashKey()};
+      if (sessions.count(id))
+        sessions[id]->ended = true;
+      sessions[id] = session;
+      schedule(session);
+    }
+    else if (command == "move")
+    {
+      string move;
+      tokens >> move;
+      auto found = sessions.find(id);
+      if (found == sessions.end())
+      {
+        reply("error " + id + " unknown game");
+        return;
+      }
+      shared_ptr<Session> session = found->second;
+      if (session->searching)
+      {
+        reply("error " + id + " not your turn");
+        return;
+      }
+      vector<string> moves = session->board.findPossibleMoves(session->board.turn);
+      if (find(moves.begin(), moves.end(), move) == moves.end())
+      {
+        reply("error " + id + " illegal move " + move);
+        return;
+      }
+      session->board.makeMove(move);
+      recordPosition(session->history, session->board);
+      schedule(session);
+    }
+    else if (command == "end")
+    {
+      auto found = sessions.find(id);
+      if (found != sessions.end())
+      {
+        found->second->ended = true;
+        sessions.erase(found);
+      }
+    }
+    else
+      reply("error " + id + " unknown command " + command);
+  }
+
+  // Spends a twentieth of the clock plus half the increment, never more than half the clock
+  int budget(int remaining, int increment)
+  {
+    return max(1, min(remaining / 20 + increment / 2, remaining / 2));
+  }
+
+  void worker()
+  {
+    SearchContext ctx;
+    while (true)
+    {
+      shared_ptr<Session> session;
+      Board board;
+      vector<uint64_t> history;
+      int movetime = 0, maxDepth;
+      chrono::steady_clock::time_point start;
+      {
+        unique_lock<mutex> guard(lock);
+        ready.wait(guard, [&]
+                   { return finished || queue.size() > 0; });
+        if (queue.size() == 0)
+          return;
+        session = queue.front();
+        queue.pop_front();
+        board = session->board;
+        history = session->history;
+        // Time spent waiting behind other games comes off this game's clock, so the budget is
+        // taken from what is left and the deadline counts from when the search was queued
+        start = session->queued;
+        if (session->remaining > 0)
+        {
+          int waited = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+          movetime = waited + budget(max(1, session->remaining - waited), session->increment);
+        }
+        maxDepth = movetime > 0 ? 64 : session->depth;
+      }
+      // Started before the book and solver so their time comes out of the budget too
+      ctx.reset(movetime, start);
+      ctx.setHistory(history);
+      vector<string> moves = board.findPossibleMoves(session->ai);
+      string move;
+      if (moves.size() > 0)
+      {
+        move = instantMove(board, session->ai, moves);
+        if (move == "")
+          move = board.search(session->ai, maxDepth, ctx).move;
+      }
+      int elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+      lock_guard<mutex> guard(lock);
+      session->searching = false;
+      if (session->ended)
+        continue;
+      if (move == "")
+      {
+        reply("bestmove " + session->id + " (none)");
+        continue;
+      }
+      if (session->remaining > 0)
+        session->remaining = max(1, session->remaining - elapsed + session->increment);
+      session->board.makeMove(move);
+      recordPosition(session->history, session->board);
+      reply("bestmove " + session->id + " " + move);
+    }
+  }
+};
+
+// Usage: ./a.out server [--threads n] [--depth plies]
+// --depth is the search depth for games started without a clock
+void runServer(int argc, char *argv[])
+{
+  int threads = stoi(getOption(argc, argv, "--threads", to_string(defaultThreads())));
+  int depth = stoi(getOption(argc, argv, "--depth", "6"));
+  GameServer server(cin, cout, max(threads, 1), depth);
+  server.run();
+}
+
+// Usage: ./a.out convert [--pgn file] [--out file] [--skip plies]
+// Appends the quiet positions of PGN games, after the first skip plies, as training data
+void runConvert(int argc, char *argv[])
+{
+  string pgnPath = getOption(argc, argv, "--pgn", "-");
+  string out = getOption(argc, argv, "--out", "data.bin");
+  int skip = stoi(getOption(argc, argv, "--skip", "8"));
+  ifstream file;
+  if (pgnPath != "-")
+  {
+    file.open(pgnPath);
+    if (!file)
+    {
+      cerr << "Cannot open " << pgnPath << endl;
+      return;
+    }
+  }
+  TrainingWriter data;
+  if (!data.open(out))
+  {
+    cerr << "Cannot open " << out << endl;
+    return;
+  }
+  int games = readPgnGames(pgnPath == "-" ? cin : file, [&](const string &fen, const string &movetext, const string &result)
+                           {
+    Board board;
+    if (fen != "" && !board.loadFen(fen))
+      return;
+    vector<Board> positions;
+    vector<string> moves = parsePgnMoves(board, movetext, 1000);
+    for (int i = 0; i < moves.size(); i++)
+    {
+      if (i >= skip)
+        positions.push_back(board);
+      board.makeMove(moves[i]);
+    }
+    // The final position counts as ply moves.size(), so short games are skipped entirely
+    if ((int)moves.size() >= skip)
+      positions.push_back(board);
+    data.addGame(positions, result == "1-0" ? 1 : result == "0-1" ? -1 : 0); });
+  cerr << "Read " << games << " games, wrote " << data.size() << " positions to " << out << endl;
+}
+
+// Usage: ./a.out tune --data file [--out file] [--threads n] [--passes n]
+// Starts from the --weights file if given, otherwise the built-in piece values
+void runTune(int argc, char *argv[])
+{
+  string dataPath = getOption(argc, argv, "--data", "data.bin");
+  string out = getOption(argc, argv, "--out", "weights.txt");
+  int threads = stoi(getOption(argc, argv, "--threads", to_string(defaultThreads())));
+  int passes = stoi(getOption(argc, argv, "--passes", "100"));
+  TexelTuner tuner(max(threads, 1));
+  if (!tuner.load(dataPath))
+  {
+    cerr << "Cannot load training data " << dataPath << endl;
+    return;
+  }
+  cerr << "Tuning on " << tuner.size() << " positions" << endl;
+  EvalWeights weights = tuner.tune(engineWeights, passes);
+  if (!TexelTuner::save(weights, out))
+  {
+    cerr << "Cannot write " << out << endl;
+    return;
+  }
+  cerr << "Wrote " << out << endl;
+}
+
+int main(int argc, char *argv[])
+{
+  searchOptions.parse(argc, argv);
+  string tablebaseDir = getOption(argc, argv, "--tb", "");
+  if (tablebaseDir != "")
+    cerr << "Loaded " << tablebases.load(tablebaseDir) << " tablebases from " << tablebaseDir << endl;
+  string bookPath = getOption(argc, argv, "--book", "");
+  if (bookPath != "" && !book.load(bookPath))
+    cerr << "Cannot load book " << bookPath << endl;
+  string hashPath = getOption(argc, argv, "--load-hash", "");
+  transpositions.numa = getOption(argc, argv, "--numa", "");
+  if (hashPath != "" && transpositions.load(hashPath))
+    cerr << "Loaded " << transpositions.sizeMB() << " MB hash from " << hashPath << endl;
+  else
+  {
+    if (hashPath != "")
+      cerr << "Cannot load hash " << hashPath << endl;
+    transpositions.resize(stoull(getOption(argc, argv, "--hash", "64")));
+  }
+  string weightsPath = getOption(argc, argv, "--weights", "");
+  if (weightsPath != "" && !engineWeights.load(weightsPath))
+    cerr << "Cannot load weights " << weightsPath << endl;
+  if (argc >= 2 && string(argv[1]) == "batch")
+  {
+    runBatch(argc, argv);
+    return 0;
+  }
+  if (argc >= 2 && string(argv[1]) == "analyse")
+  {
+    runAnalyse(argc, argv);
+    return 0;
+  }
+  if (argc >= 2 && string(argv[1]) == "selfplay")
+  {
+    runSelfPlay(argc, argv);
+    return 0;
+  }
+  if (argc >= 2 && string(argv[1]) == "book")
+  {
+    runBookBuilder(argc, argv);
+    return 0;
+  }
+  if (argc >= 2 && string(argv[1]) == "tbgen")
+  {
+    runTablebaseGen(argc, argv);
+    return 0;
+  }
+  if (argc >= 2 && string(argv[1]) == "tbprobe")
+  {
+    runTablebaseProbe(argc, argv);
+    return 0;
+  }
+  if (argc >= 2 && string(argv[1]) == "solve")
+  {
+    runSolve(argc, argv);
+    return 0;
+  }
+  if (argc >= 2 && string(argv[1]) == "server")
+  {
+    runServer(argc, argv);
+    return 0;
+  }
+  if (argc >= 2 && string(argv[1]) == "convert")
+  {
+    runConvert(argc, argv);
+    return 0;
+  }
+  if (argc >= 2 && string(argv[1]) == "tune")
+  {
+    runTune(argc, argv);
+    return 0;
+  }
   moveIterator(argc, argv);
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Regression test: drawn endings must never be reported as a win or a loss,
+# including when one solver is reused across positions read from stdin
+# Usage: tests/solve_draws.sh [path to a.out]
+engine=${1:-./a.out}
+output=$(printf '%s\n' \
+  "8/8/8/8/2k5/8/8/2K5 w - - 0 1" \
+  "8/3B4/8/8/8/8/8/7k b - - 0 1" \
+  "8/8/8/1P6/8/3k4/8/8 w - - 0 1" \
+  "8/8/8/8/8/8/8/B6b w - - 0 1" |
+  "$engine" solve --nodes 200000 --hash 16)
+echo "$output"
+if echo "$output" | grep -Eq "result (win|loss)"; then
+  echo "FAIL: a drawn position was reported as decided"
+  exit 1
+fi
+echo "PASS"